@@ -2,7 +2,7 @@
 
 if not exist "build" mkdir build
 
-set cxxflags=-std=c++23 -sINITIAL_MEMORY=64MB -sUSE_SDL=2 -sMIN_WEBGL_VERSION=2 -sMAX_WEBGL_VERSION=2
+set cxxflags=-std=c++23 -ffp-contract=off -sINITIAL_MEMORY=64MB -sUSE_SDL=2 -sMIN_WEBGL_VERSION=2 -sMAX_WEBGL_VERSION=2
 set lddflags=-Iexternal/glm
 set warnings=-Wall -Wpedantic -Wsign-conversion -Wno-gnu-anonymous-struct -Wno-nested-anon-types
 set debugflags=-sSAFE_HEAP=1 -sSTACK_OVERFLOW_CHECK=2 -fno-omit-frame-pointer -g 
@@ -10,3 +10,14 @@ set releaseflags=-DNDEBUG -O3
 
 em++ src/sdlgl_main.cpp -o build/main.js %cxxflags% %lddflags% %debugflags% %warnings%
 echo em++ src/sdlgl_main.cpp            -o build/main.js %cxxflags% %lddflags% %releaseflags%
+
+rem Threaded SIMD flavour, loaded instead of main.js on cross-origin isolated pages
+rem (see emscripten_common.js). The sim and the job pool get a worker per core,
+rem and every thread's scratch arena needs room, so it starts with more memory.
+set mtflags=-msimd128 -pthread -sINITIAL_MEMORY=256MB -sPTHREAD_POOL_SIZE=navigator.hardwareConcurrency
+em++ src/sdlgl_main.cpp -o build/main_mt.js %cxxflags% %mtflags% %lddflags% %debugflags% %warnings%
+echo em++ src/sdlgl_main.cpp            -o build/main_mt.js %cxxflags% %mtflags% %lddflags% %releaseflags%
+
+rem Native physics benchmarks, no SDL/GL
+clang++ src/bench_main.cpp -o build/bench.exe -std=c++23 -ffp-contract=off -mavx2 %lddflags% %releaseflags% %warnings%
+clang++ src/replay_main.cpp -o build/replay.exe -std=c++23 -ffp-contract=off -mavx2 %lddflags% %releaseflags% %warnings%
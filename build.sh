@@ -0,0 +1,31 @@
+#!/bin/sh
+# Native builds for Linux. The web builds of the game come from build.bat.
+
+mkdir -p build
+
+cxxflags="-std=c++23 -ffp-contract=off -march=native -pthread"
+lddflags="-Iexternal/glm"
+warnings="-Wall -Wpedantic -Wsign-conversion -Wno-gnu-anonymous-struct -Wno-nested-anon-types"
+releaseflags="-DNDEBUG -O3"
+
+# Headless physics benchmarks, no SDL/GL. Run as build/bench [names...]
+clang++ src/bench_main.cpp -o build/bench $cxxflags $lddflags $releaseflags $warnings
+
+# Replays input logs recorded with --record. Run as build/replay <log>
+clang++ src/replay_main.cpp -o build/replay $cxxflags $lddflags $releaseflags $warnings
+
+# The game on SDL2 and Mesa's GLES. build/melon --headless <frames> draws
+# offscreen through a surfaceless EGL context, no display or GPU needed, and
+# prints frames per second; --fruit <n> sets the load, --dump <dir> keeps
+# every frame as a PPM
+if pkg-config --exists sdl2 egl glesv2; then
+  clang++ src/sdlgl_main.cpp -o build/melon $cxxflags $lddflags $releaseflags $warnings $(pkg-config --cflags --libs sdl2 egl glesv2)
+fi
+
+# The benchmarks built like each web flavour, to compare them headless under
+# Node: node build/bench_wasm.js threads, then build/bench_wasm_mt.js
+if command -v em++ > /dev/null; then
+  wasmflags="-std=c++23 -ffp-contract=off -sENVIRONMENT=node -sEXIT_RUNTIME=1"
+  em++ src/bench_main.cpp -o build/bench_wasm.js $wasmflags -sINITIAL_MEMORY=128MB $lddflags $releaseflags $warnings
+  em++ src/bench_main.cpp -o build/bench_wasm_mt.js $wasmflags -msimd128 -pthread -sINITIAL_MEMORY=256MB -sPTHREAD_POOL_SIZE=16 $lddflags $releaseflags $warnings
+fi
@@ -18,3 +18,18 @@ var Module = {
   })(),
 };
 
+// main_mt.js is the threaded SIMD build. Threads need SharedArrayBuffer,
+// which browsers only give pages that are cross-origin isolated (served with
+// Cross-Origin-Opener-Policy: same-origin and
+// Cross-Origin-Embedder-Policy: require-corp). Anywhere else, or without
+// wasm SIMD, the single threaded main.js runs instead.
+(function() {
+    // A module with one function, i8x16.popcnt(i8x16.splat(0)), which only
+    // validates where wasm has SIMD
+    var simd = WebAssembly.validate(new Uint8Array([
+        0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10,
+        10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11]));
+    var script = document.createElement("script");
+    script.src = (self.crossOriginIsolated && simd) ? "main_mt.js" : "main.js";
+    document.body.appendChild(script);
+})();
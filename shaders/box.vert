@@ -3,7 +3,10 @@ R"(#version 300 es
 
 precision highp float;
 
-uniform mat4 pvm;
+layout(std140) uniform camera {
+  mat4 proj_view;
+};
+uniform mat4 model;
 
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
@@ -11,7 +14,7 @@ layout(location = 1) in vec3 in_normal;
 out vec3 normal;
 
 void main() {
-  gl_Position = pvm*vec4(in_position, 1.0f);
+  gl_Position = proj_view*model*vec4(in_position, 1.0f);
   normal = in_normal;
 }
 )"
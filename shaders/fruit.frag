@@ -1,11 +1,15 @@
 /* Wrapped by raw string so it can be #included into the code*/
 R"(#version 300 es
 precision highp float;
+precision highp int;
 
 in vec3 normal;
 in vec3 colour;
+flat in uvec2 fruit;
 
-out vec4 colour_out;
+layout(location = 0) out vec4 colour_out;
+// Only there when drawing for screen space outlines
+layout(location = 1) out uvec2 fruit_out;
 
 void main() {
   vec3 diffuse_colour = colour;
@@ -18,5 +22,6 @@ void main() {
   vec3 diffuse = diffuse_colour * max(dot(n, vec3(0.0f, 0.4f, 0.98f)), 0.0f);
 
   colour_out = vec4(diffuse + ambient, 1.0f);
+  fruit_out = fruit;
 }
 )"
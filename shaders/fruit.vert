@@ -3,32 +3,50 @@ R"(#version 300 es
 
 precision highp float;
 
-uniform mat4 pv;
+layout(std140) uniform camera {
+  mat4 proj_view;
+};
+// TABLE_fruit_type, radii and colours in xyz
+layout(std140) uniform fruit_types {
+  vec4 fruit_dims[64];
+  vec4 fruit_colours[64];
+};
 uniform bool outline;
+uniform uint first_slot; // Instance 0's slot in the instance buffer
 
 layout(location = 0) in vec3 position;
 
 layout(location = 1) in vec3 inst_position;
-layout(location = 2) in mat3 inst_orientation;
-layout(location = 5) in int inst_id;
+// Smallest three quaternion, see fruit_instance.h
+layout(location = 2) in vec4 inst_orientation;
+layout(location = 3) in uint inst_id;
 
 out vec3 normal;
 out vec3 colour;
+flat out uvec2 fruit; // Slot + 1 and type, for screen space outlines
 
-const vec3 fruit_dims[2] = vec3[2](
-  vec3(0.1f, 0.1f, 0.1f),
-  vec3(0.14f, 0.2f, 0.14f)
-);
-const vec3 fruit_colours[2] = vec3[2](
-  vec3(1.0f, 0.0f, 0.0f),
-  vec3(0.0f, 1.0f, 0.0f)
-);
+vec4 unpack_quat(vec4 smallest3) {
+  vec3 abc = (smallest3.xyz / 1023.0f * 2.0f - 1.0f) * 0.70710678f;
+  float largest = sqrt(max(1.0f - dot(abc, abc), 0.0f));
+  switch (int(smallest3.w)) {
+  case 0: return vec4(largest, abc);
+  case 1: return vec4(abc.x, largest, abc.yz);
+  case 2: return vec4(abc.xy, largest, abc.z);
+  default: return vec4(abc, largest);
+  }
+}
+
+vec3 rotate(vec4 q, vec3 v) {
+  return v + 2.0f * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
 
 void main() {
+  vec4 q = unpack_quat(inst_orientation);
   float border = (outline) ? 0.05f : 0.0f;
-  vec3 pos = position * fruit_dims[inst_id] * (1.0f + border);
-  gl_Position = pv*vec4(inst_orientation*pos + inst_position, 1.0f);
-  normal = (outline) ? vec3(0.0f) : inst_orientation*position;
-  colour = (outline) ? fruit_colours[inst_id] * 0.5f : fruit_colours[inst_id];
+  vec3 pos = position * fruit_dims[inst_id].xyz * (1.0f + border);
+  gl_Position = proj_view*vec4(rotate(q, pos) + inst_position, 1.0f);
+  normal = (outline) ? vec3(0.0f) : rotate(q, position);
+  colour = fruit_colours[inst_id].xyz * ((outline) ? 0.5f : 1.0f);
+  fruit = uvec2(first_slot + uint(gl_InstanceID) + 1u, inst_id);
 }
 )"
@@ -0,0 +1,51 @@
+/* Wrapped by raw string so it can be #included into the code*/
+R"(#version 300 es
+precision highp float;
+precision highp int;
+precision highp usampler2D;
+
+// The fruit drawn once, with which fruit covers each pixel alongside
+uniform sampler2D scene_colour;
+uniform usampler2D scene_fruit; // Slot + 1 (0 for none) and type
+uniform sampler2D scene_depth;
+uniform float width; // Outline width in pixels
+
+out vec4 colour_out;
+
+// As fruit.vert
+layout(std140) uniform fruit_types {
+  vec4 fruit_dims[64];
+  vec4 fruit_colours[64];
+};
+
+// Any pixel near the edge of a fruit in front of it takes that fruit's
+// outline colour, which draws the outline around the outside like the
+// inflated back faces did
+void main() {
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  ivec2 size = textureSize(scene_fruit, 0) - 1;
+  uint own = texelFetch(scene_fruit, p, 0).x;
+  float depth = texelFetch(scene_depth, p, 0).x;
+
+  float nearest = depth;
+  uint outline_type = 0xFFFFu;
+  for (int k = 0; k < 8; ++k) {
+    float angle = float(k) * 0.78539816f;
+    ivec2 q = clamp(p + ivec2(round(width * vec2(cos(angle), sin(angle)))),
+                    ivec2(0), size);
+    uvec2 other = texelFetch(scene_fruit, q, 0).xy;
+    float other_depth = texelFetch(scene_depth, q, 0).x;
+    if (other.x != 0u && other.x != own && other_depth < nearest) {
+      nearest = other_depth;
+      outline_type = other.y;
+    }
+  }
+
+  if (outline_type != 0xFFFFu) {
+    colour_out = vec4(fruit_colours[outline_type].xyz * 0.5f, 1.0f);
+  } else {
+    colour_out = texelFetch(scene_colour, p, 0);
+  }
+  gl_FragDepth = nearest;
+}
+)"
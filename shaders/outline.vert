@@ -0,0 +1,12 @@
+/* Wrapped by raw string so it can be #included into the code*/
+R"(#version 300 es
+
+precision highp float;
+
+// One triangle covering the screen, no vertex buffer needed
+
+void main() {
+  vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+  gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+)"
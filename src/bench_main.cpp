@@ -0,0 +1,752 @@
+#include "types.h"
+
+#include <chrono>
+
+#include "fruit_instance.cpp"
+#include "input_log.cpp"
+#include "jobs.cpp"
+#include "melongame.cpp"
+#include "physics.cpp"
+#include "trace.cpp"
+
+// Native benchmarks for the physics and the CPU side of drawing, no SDL or
+// GL needed.
+// Results are printed one per line as key=value pairs.
+
+u64 bench_now_ns() {
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+// xorshift32, so every run lays out the same scene
+float bench_rand01(u32 *state) {
+  u32 x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return (float)(x >> 8) / (float)(1 << 24);
+}
+
+// Jittered lattice over the box footprint, stacked as high as needed.
+// Spacing is a little under a melon's width, so neighbours overlap like a
+// settled pile would.
+void bench_make_pile(fruit_body *fruit, iZ num_bodies, u32 seed) {
+  float spacing = 0.38f;
+  int per_row = (int)(BOX_WIDTH / spacing);
+  int per_layer = per_row * per_row;
+  for (int i = 0; i < num_bodies; ++i) {
+    int layer = i / per_layer;
+    int row = (i % per_layer) / per_row;
+    int col = i % per_row;
+
+    vec3 jitter;
+    jitter.x = bench_rand01(&seed) - 0.5f;
+    jitter.y = bench_rand01(&seed) - 0.5f;
+    jitter.z = bench_rand01(&seed) - 0.5f;
+    vec3 p = vec3(-BOX_WIDTH / 2.0f + (col + 0.5f) * spacing,
+                  -BOX_DEPTH / 2.0f + (row + 0.5f) * spacing,
+                  (layer + 0.5f) * spacing) +
+             0.1f * jitter;
+
+    fruit[i].body.position = p;
+    fruit[i].body.orientation = quat(1.0f, 0.0f, 0.0f, 0.0f);
+    fruit[i].id = bench_rand01(&seed) < 0.5f ? FRUIT_APPLE : FRUIT_MELON;
+  }
+}
+
+collision_body *bench_colliders(fruit_body *fruit, iZ n, arena *mem) {
+  collision_body *colliders = arena_push<collision_body>(mem, n);
+  for (iZ i = 0; i < n; ++i) {
+    colliders[i] = make_collision_body(&fruit[i]);
+  }
+  return colliders;
+}
+
+void bench_broadphase(arena *mem) {
+  iZ counts[] = {256, 1024, 4096};
+  int reps = 50;
+
+  for (iZ n : counts) {
+    arena scratch = *mem;
+    fruit_body *fruit = arena_push<fruit_body>(&scratch, n);
+    bench_make_pile(fruit, n, 1234);
+    collision_body *colliders = bench_colliders(fruit, n, &scratch);
+    vec3 box = vec3(BOX_WIDTH, BOX_DEPTH, BOX_HEIGHT);
+
+    iZ num_pairs = 0;
+    u64 best = ~0ull;
+    u64 total = 0;
+    for (int r = 0; r < reps; ++r) {
+      arena frame = scratch;
+      u64 t0 = bench_now_ns();
+      array<body_pair> pairs = broadphase_pairs(colliders, n, box, &frame);
+      u64 t1 = bench_now_ns();
+      num_pairs = pairs.size();
+      best = glm::min(best, t1 - t0);
+      total += t1 - t0;
+    }
+
+    printf("broadphase bodies=%td pairs=%td best_us=%.2f mean_us=%.2f\n", n,
+           num_pairs, best / 1e3, total / 1e3 / reps);
+  }
+}
+
+quat bench_rand_rotation(u32 *seed) {
+  vec3 axis;
+  axis.x = bench_rand01(seed) - 0.5f;
+  axis.y = bench_rand01(seed) - 0.5f;
+  axis.z = bench_rand01(seed) - 0.5f;
+  float angle = (float)TWO_PI * bench_rand01(seed);
+  return glm::angleAxis(angle, glm::normalize(axis));
+}
+
+// Pairs of every fruit type combination, randomly oriented and just touching
+// (up to 2% overlap) like in a settled pile. Cold runs start with no axis,
+// warm runs reuse the axes the cold run found.
+void bench_narrowphase(arena *mem) {
+  iZ n = 1024;
+  int reps = 20;
+
+  for (u32 type_a = 0; type_a < FRUIT_TYPES; ++type_a) {
+    for (u32 type_b = type_a; type_b < FRUIT_TYPES; ++type_b) {
+      arena scratch = *mem;
+      collision_body *a = arena_push<collision_body>(&scratch, n);
+      collision_body *b = arena_push<collision_body>(&scratch, n);
+      vec3 *axes = arena_push<vec3>(&scratch, n);
+
+      u32 seed = 4321;
+      for (int i = 0; i < n; ++i) {
+        fruit_body fa, fb;
+        fa.id = type_a;
+        fb.id = type_b;
+        fa.body.position = fb.body.position = vec3(0.0f);
+        fa.body.orientation = bench_rand_rotation(&seed);
+        fb.body.orientation = bench_rand_rotation(&seed);
+        a[i] = make_collision_body(&fa);
+        b[i] = make_collision_body(&fb);
+
+        vec3 d;
+        d.x = bench_rand01(&seed) - 0.5f;
+        d.y = bench_rand01(&seed) - 0.5f;
+        d.z = bench_rand01(&seed) - 0.5f;
+        d = glm::normalize(d);
+        float reach = glm::dot(support_ellip(&a[i], d), d) +
+                      glm::dot(support_ellip(&b[i], -d), -d);
+        a[i].position = vec3(0.0f);
+        b[i].position = d * reach * (1.0f - 0.02f * bench_rand01(&seed));
+      }
+
+      float gap_sum = 0.0f;
+      u64 cold = ~0ull, warm = ~0ull;
+      for (int r = 0; r < reps; ++r) {
+        u64 t0 = bench_now_ns();
+        for (int i = 0; i < n; ++i) {
+          axes[i] = vec3(0.0f);
+          gap_sum += collision_ellip_ellip(&a[i], &b[i], &axes[i]).gap;
+        }
+        u64 t1 = bench_now_ns();
+        for (int i = 0; i < n; ++i) {
+          gap_sum += collision_ellip_ellip(&a[i], &b[i], &axes[i]).gap;
+        }
+        u64 t2 = bench_now_ns();
+        cold = glm::min(cold, t1 - t0);
+        warm = glm::min(warm, t2 - t1);
+      }
+
+      printf("narrowphase a=%s b=%s pairs=%td cold_ns=%.1f warm_ns=%.1f "
+             "mean_gap=%.5f\n",
+             TABLE_fruit_type[type_a].label, TABLE_fruit_type[type_b].label,
+             n, (double)cold / n, (double)warm / n,
+             gap_sum / (2.0f * reps * n));
+    }
+  }
+}
+
+// Integration kernels, lanes_simd against the lanes_scalar reference, which
+// have to agree bit for bit
+void bench_kernels(arena *mem) {
+  iZ n = MAX_FRUIT;
+  int steps = 200;
+  float dt = 1.0f / 120.0f;
+
+  arena scratch = *mem;
+  body_store stores[2];
+  stores[0] = new_body_store(&scratch, n);
+  stores[1] = new_body_store(&scratch, n);
+
+  u32 seed = 77;
+  for (iZ i = 0; i < n; ++i) {
+    vec3 p, v, w;
+    for (int k = 0; k < 3; ++k) {
+      p[k] = bench_rand01(&seed);
+      v[k] = 4.0f * bench_rand01(&seed) - 2.0f;
+      w[k] = 8.0f * bench_rand01(&seed) - 4.0f;
+    }
+    quat q = bench_rand_rotation(&seed);
+    u32 id = bench_rand01(&seed) < 0.5f ? FRUIT_APPLE : FRUIT_MELON;
+    for (body_store &s : stores) {
+      body_store_push(&s, p, q, id);
+      s.vx[i] = v.x, s.vy[i] = v.y, s.vz[i] = v.z;
+      s.wx[i] = w.x, s.wy[i] = w.y, s.wz[i] = w.z;
+    }
+  }
+
+  u64 t0 = bench_now_ns();
+  for (int t = 0; t < steps; ++t) {
+    integrate_velocities_kernel<lanes_scalar>(&stores[0], dt, -10.0f);
+    integrate_positions_kernel<lanes_scalar>(&stores[0], dt);
+  }
+  u64 t1 = bench_now_ns();
+  for (int t = 0; t < steps; ++t) {
+    integrate_velocities_kernel<lanes_simd>(&stores[1], dt, -10.0f);
+    integrate_positions_kernel<lanes_simd>(&stores[1], dt);
+  }
+  u64 t2 = bench_now_ns();
+
+  float *arrays[2][10];
+  for (int k = 0; k < 2; ++k) {
+    body_store &s = stores[k];
+    float *a[10] = {s.px, s.py, s.pz, s.vx, s.vy,
+                    s.vz, s.qx, s.qy, s.qz, s.qw};
+    memcpy(arrays[k], a, sizeof(a));
+  }
+  bool identical = true;
+  for (int k = 0; k < 10; ++k) {
+    identical &= !memcmp(arrays[0][k], arrays[1][k], (uZ)n * sizeof(float));
+  }
+
+  printf("kernels lanes=%s bodies=%td scalar_ns=%.2f simd_ns=%.2f "
+         "identical=%d\n",
+         SIMD_NAME, n, (double)(t1 - t0) / steps / n,
+         (double)(t2 - t1) / steps / n, identical);
+}
+
+// What it costs the solver's inner loop to reach bodies through handles
+// instead of indices. The store has had a third of its bodies removed and
+// replaced first, so handles and slots no longer line up.
+void bench_handles(arena *mem) {
+  iZ n = MAX_FRUIT;
+  int reps = 200;
+
+  arena scratch = *mem;
+  fruit_body *fruit = arena_push<fruit_body>(&scratch, n);
+  bench_make_pile(fruit, n, 99);
+  body_store s = new_body_store(&scratch, n);
+  for (iZ i = 0; i < n; ++i) {
+    body_store_push(&s, fruit[i].body.position, fruit[i].body.orientation,
+                    fruit[i].id);
+  }
+  u32 *removed = arena_push<u32>(&scratch, n);
+  u32 *remap = arena_push<u32>(&scratch, n);
+  iZ num_removed = 0;
+  for (iZ i = 0; i < n; i += 3) {
+    removed[num_removed++] = (u32)i;
+  }
+  body_store_remove(&s, removed, num_removed, remap);
+  for (iZ r = 0; r < num_removed; ++r) {
+    const fruit_body &f = fruit[removed[r]];
+    body_store_push(&s, f.body.position, f.body.orientation, f.id);
+  }
+
+  collision_body *colliders = arena_push<collision_body>(&scratch, n);
+  for (iZ i = 0; i < n; ++i) {
+    colliders[i] = load_collision_body(&s, i);
+  }
+  array<body_pair> pairs = broadphase_pairs(
+      colliders, n, vec3(BOX_WIDTH, BOX_DEPTH, BOX_HEIGHT), &scratch);
+  iZ num_pairs = pairs.size();
+  body_handle *handles = arena_push<body_handle>(&scratch, 2 * num_pairs);
+  for (iZ p = 0; p < num_pairs; ++p) {
+    handles[2 * p] = body_store_handle(&s, pairs.base[p].a);
+    handles[2 * p + 1] = body_store_handle(&s, pairs.base[p].b);
+  }
+
+  // Pushes each pair apart along z, in the order the solver goes
+  auto solve = [&](u32 a, u32 b) {
+    float impulse =
+        (s.vz[b] - s.vz[a] + 1e-3f) / (s.inv_mass[a] + s.inv_mass[b]);
+    s.vz[a] += impulse * s.inv_mass[a];
+    s.vz[b] -= impulse * s.inv_mass[b];
+  };
+
+  u64 t0 = bench_now_ns();
+  for (int r = 0; r < reps; ++r) {
+    for (iZ p = 0; p < num_pairs; ++p) {
+      solve(pairs.base[p].a, pairs.base[p].b);
+    }
+  }
+  u64 t1 = bench_now_ns();
+  float by_index = 0.0f;
+  for (iZ i = 0; i < n; ++i) {
+    by_index += s.vz[i];
+    s.vz[i] = 0.0f;
+  }
+
+  u64 t2 = bench_now_ns();
+  for (int r = 0; r < reps; ++r) {
+    for (iZ p = 0; p < num_pairs; ++p) {
+      solve((u32)body_store_lookup(&s, handles[2 * p]),
+            (u32)body_store_lookup(&s, handles[2 * p + 1]));
+    }
+  }
+  u64 t3 = bench_now_ns();
+  float by_handle = 0.0f;
+  for (iZ i = 0; i < n; ++i) {
+    by_handle += s.vz[i];
+  }
+
+  printf("handles bodies=%td pairs=%td index_ns=%.2f handle_ns=%.2f "
+         "identical=%d\n",
+         n, num_pairs, (double)(t1 - t0) / reps / num_pairs,
+         (double)(t3 - t2) / reps / num_pairs, by_index == by_handle);
+}
+
+// Packing every fruit into GPU instances, and the worst rotation error (the
+// largest entry of the difference) that packing leaves
+void bench_instances(arena *mem) {
+  iZ n = MAX_FRUIT;
+  int reps = 200;
+
+  arena scratch = *mem;
+  fruit_body *fruit = arena_push<fruit_body>(&scratch, n);
+  bool *moved = arena_push<bool>(&scratch, n);
+  fruit_instance *instances = arena_push<fruit_instance>(&scratch, n);
+  u32 seed = 31;
+  bench_make_pile(fruit, n, seed);
+  for (iZ i = 0; i < n; ++i) {
+    fruit[i].body.orientation = bench_rand_rotation(&seed);
+    moved[i] = true;
+  }
+
+  u64 t0 = bench_now_ns();
+  for (int r = 0; r < reps; ++r) {
+    pack_fruit_instances(fruit, moved, n, instances);
+  }
+  u64 t1 = bench_now_ns();
+
+  float max_error = 0.0f;
+  for (iZ i = 0; i < n; ++i) {
+    mat3 R = unpack_orientation(instances[i].orientation);
+    mat3 want = glm::mat3_cast(fruit[i].body.orientation);
+    for (int c = 0; c < 3; ++c) {
+      vec3 d = glm::abs(R[c] - want[c]);
+      max_error = glm::max(max_error, glm::max(d.x, glm::max(d.y, d.z)));
+    }
+  }
+
+  printf("instances bodies=%td bytes=%td was_bytes=%td pack_ns=%.2f "
+         "max_rotation_error=%.5f\n",
+         n, (iZ)sizeof(fruit_instance), (iZ)sizeof(fruit_body),
+         (double)(t1 - t0) / reps / n, max_error);
+}
+
+// Draw list for a full box seen from the game's starting camera, and what
+// it sends against every fruit at full detail. The old sphere was 3072
+// unindexed triangles, drawn twice for the outline.
+void bench_culling(arena *mem) {
+  iZ n = MAX_FRUIT;
+  int reps = 200;
+  int width = 900, height = 600;
+  float fov_y = 69.0f;
+
+  arena scratch = *mem;
+  fruit_body *fruit = arena_push<fruit_body>(&scratch, n);
+  bool *moved = arena_push<bool>(&scratch, n);
+  fruit_instance *instances = arena_push<fruit_instance>(&scratch, n);
+  bench_make_pile(fruit, n, 5);
+  for (iZ i = 0; i < n; ++i) {
+    moved[i] = true;
+  }
+  pack_fruit_instances(fruit, moved, n, instances);
+
+  fruit_view view;
+  view.camera_pos = vec3(0, -2, 1);
+  view.proj_view = glm::perspective(glm::radians(fov_y),
+                                    (float)width / (float)height, 0.1f,
+                                    1000.0f) *
+                   glm::lookAt(view.camera_pos, vec3(0, 0, 1), vec3(0, 0, 1));
+  view.pixel_scale = height / (2.0f * tanf(glm::radians(fov_y) / 2.0f));
+
+  fruit_draw_list list = new_fruit_draw_list(&scratch, n);
+  u64 t0 = bench_now_ns();
+  for (int r = 0; r < reps; ++r) {
+    build_fruit_draw_list(&list, instances, n, &view, &scratch);
+  }
+  u64 t1 = bench_now_ns();
+
+  iZ tris = 0, verts = 0;
+  iZ lod_count[FRUIT_LODS];
+  for (int lod = 0; lod < FRUIT_LODS; ++lod) {
+    lod_count[lod] = list.lod_start[lod + 1] - list.lod_start[lod];
+    tris += 2 * lod_count[lod] * fruit_lod_tris(lod);
+    verts += 2 * lod_count[lod] * fruit_lod_verts(lod);
+  }
+  iZ old_tris = 2 * n * 2 * 32 * 16;
+
+  printf("culling bodies=%td visible=%td lod0=%td lod1=%td lod2=%td "
+         "tris=%td verts=%td old_tris=%td old_verts=%td build_ns=%.2f\n",
+         n, list.lod_start[FRUIT_LODS], lod_count[0], lod_count[1],
+         lod_count[2], tris, verts, old_tris, 3 * old_tris,
+         (double)(t1 - t0) / reps / n);
+}
+
+// Worst overlap and fastest body, how well a pile has settled
+void bench_pile_quality(melon_state *m, arena *mem, float *max_overlap,
+                        float *max_speed) {
+  arena scratch = *mem;
+  iZ n = m->bodies.num;
+  collision_body *colliders = arena_push<collision_body>(&scratch, n);
+  for (iZ i = 0; i < n; ++i) {
+    colliders[i] = load_collision_body(&m->bodies, i);
+  }
+  container_plane planes[CONTAINER_PLANES];
+  container_planes(m->physics.box, planes);
+
+  *max_overlap = 0.0f;
+  *max_speed = 0.0f;
+  array<body_pair> pairs =
+      broadphase_pairs(colliders, n, m->physics.box, &scratch);
+  for (iZ p = 0; p < pairs.size(); ++p) {
+    vec3 axis = vec3(0.0f);
+    float gap = collision_ellip_ellip(&colliders[pairs.base[p].a],
+                                      &colliders[pairs.base[p].b], &axis)
+                    .gap;
+    *max_overlap = glm::max(*max_overlap, -gap);
+  }
+  for (iZ i = 0; i < n; ++i) {
+    for (const container_plane &plane : planes) {
+      float gap = collision_ellip_plane(&colliders[i], &plane).gap;
+      *max_overlap = glm::max(*max_overlap, -gap);
+    }
+    vec3 v = load_linear_velocity(&m->bodies, i);
+    *max_speed = glm::max(*max_speed, glm::length(v));
+  }
+}
+
+// Drops a pile and lets it settle, for up to half a minute, with each solver
+// and different substep and iteration counts. Fruit merge as they land, so
+// fewer than n are left by the end.
+void bench_settle(arena *mem) {
+  iZ n = MAX_FRUIT;
+  int max_ticks = 1800;
+  int ticks = 300;
+  int settings[][3] = {{SOLVER_IMPULSE, 10, 1}, {SOLVER_IMPULSE, 10, 4},
+                       {SOLVER_IMPULSE, 4, 4},  {SOLVER_IMPULSE, 2, 8},
+                       {SOLVER_IMPULSE, 1, 8},  {SOLVER_SOFT, 10, 1},
+                       {SOLVER_SOFT, 4, 2},     {SOLVER_SOFT, 4, 4},
+                       {SOLVER_SOFT, 2, 4},     {SOLVER_SOFT, 2, 8}};
+
+  for (auto [solver, substeps, iterations] : settings) {
+    arena scratch = *mem;
+    melon_state game{};
+    melon_init(&game, &scratch, (physics_solver)solver);
+    game.physics.substeps = game.physics.max_substeps = substeps;
+    game.physics.iterations = iterations;
+
+    fruit_body *layout = arena_push<fruit_body>(&scratch, n);
+    bench_make_pile(layout, n, 1234);
+    for (iZ i = 0; i < n; ++i) {
+      add_fruit(&game, layout[i].body.position, (int)layout[i].id);
+    }
+
+    // The tick everything was asleep by, -1 if it never was
+    int settled = -1;
+    int t = 0;
+    u64 t0 = bench_now_ns();
+    for (; t < max_ticks && settled < 0; ++t) {
+      arena frame = scratch;
+      renderer_input ri;
+      melon_tick(&game, &ri, &frame);
+      if (ri.num_awake == 0) {
+        settled = t;
+      }
+    }
+    u64 t1 = bench_now_ns();
+    int settling_ticks = t;
+
+    // Once it's settled, the cost of a tick where nothing happens
+    u64 t2 = bench_now_ns();
+    for (int t = 0; t < ticks; ++t) {
+      arena frame = scratch;
+      renderer_input ri;
+      melon_tick(&game, &ri, &frame);
+    }
+    u64 t3 = bench_now_ns();
+
+    float max_overlap, max_speed;
+    bench_pile_quality(&game, &scratch, &max_overlap, &max_speed);
+    iZ left = game.bodies.num;
+    iZ awake = count_awake(&game.bodies);
+    printf("settle solver=%s bodies=%td substeps=%d iterations=%d "
+           "tick_us=%.1f settled_tick_us=%.1f settled_by=%d awake=%td "
+           "asleep=%td max_overlap=%.4f max_speed=%.4f\n",
+           TABLE_solver_name[solver], left, substeps, iterations,
+           (double)(t1 - t0) / settling_ticks / 1e3,
+           (double)(t3 - t2) / ticks / 1e3, settled, awake, left - awake,
+           max_overlap, max_speed);
+    free_job_pool(game.jobs);
+  }
+}
+
+// Lots of small piles spread over the floor of a much bigger box, so there
+// are plenty of islands to share out. With either solver the result has to
+// be the same for every thread count.
+void bench_threads(arena *mem) {
+  int piles_per_side = 8;
+  int per_pile = 16;
+  float pile_spacing = 2.0f;
+  int ticks = 120;
+  int thread_counts[] = {1, 2, 4, 8};
+
+  for (int solver = 0; solver < PHYSICS_SOLVERS; ++solver) {
+    for (int threads : thread_counts) {
+      arena scratch = *mem;
+      melon_state game{};
+      melon_init(&game, &scratch, (physics_solver)solver);
+      free_job_pool(game.jobs);
+      game.jobs = new_job_pool(&scratch, threads);
+      float side = (piles_per_side + 1) * pile_spacing;
+      game.physics.box = vec3(side, side, BOX_HEIGHT);
+
+      u32 seed = 99;
+      for (int pile = 0; pile < piles_per_side * piles_per_side; ++pile) {
+        vec3 centre =
+            pile_spacing * vec3(pile % piles_per_side - piles_per_side / 2.0f,
+                                pile / piles_per_side - piles_per_side / 2.0f,
+                                0.0f);
+        for (int i = 0; i < per_pile; ++i) {
+          vec3 p;
+          p.x = 0.3f * (i % 2) + 0.05f * bench_rand01(&seed);
+          p.y = 0.3f * (i / 2 % 2) + 0.05f * bench_rand01(&seed);
+          p.z = 0.2f + 0.3f * (i / 4);
+          add_fruit(&game, centre + p,
+                    bench_rand01(&seed) < 0.5f ? FRUIT_APPLE : FRUIT_MELON);
+        }
+      }
+
+      u64 t0 = bench_now_ns();
+      for (int t = 0; t < ticks; ++t) {
+        arena frame = scratch;
+        renderer_input ri;
+        melon_tick(&game, &ri, &frame);
+      }
+      u64 t1 = bench_now_ns();
+
+      // Builds without threads run everything on one, whatever was asked
+      printf("threads solver=%s lanes=%s threads=%d bodies=%td tick_us=%.1f "
+             "checksum=%016llx\n",
+             TABLE_solver_name[solver], SIMD_NAME, game.jobs->num_threads,
+             game.bodies.num, (double)(t1 - t0) / ticks / 1e3,
+             (unsigned long long)body_store_checksum(&game.bodies));
+      free_job_pool(game.jobs);
+    }
+  }
+}
+
+/*     ======  Canned scenes ======
+ * Whole games run through melon_tick, for comparing between commits. Each
+ * prints one line with the cost per body per substep, tick time percentiles,
+ * how much of the arena was touched, and a checksum of where everything
+ * ended up.
+ */
+
+// 1024 melons in a loose lattice, dropped into the box from above it
+void scene_drop(melon_state *m) {
+  u32 seed = 1;
+  int per_row = 4;
+  float spacing = 0.45f;
+  for (int i = 0; i < MAX_FRUIT; ++i) {
+    vec3 p;
+    p.x = (i % per_row - per_row / 2.0f + 0.5f) * spacing;
+    p.y = (i / per_row % per_row - per_row / 2.0f + 0.5f) * spacing;
+    p.z = (float)BOX_HEIGHT + (i / (per_row * per_row)) * spacing;
+    p.x += 0.05f * bench_rand01(&seed);
+    p.y += 0.05f * bench_rand01(&seed);
+    add_fruit(m, p, FRUIT_MELON);
+  }
+}
+
+// A 2x2 column of alternating fruit, 64 layers high
+void scene_tower(melon_state *m) {
+  int layers = 64;
+  for (int layer = 0; layer < layers; ++layer) {
+    for (int k = 0; k < 4; ++k) {
+      vec3 p = vec3((k % 2 - 0.5f) * 0.4f, (k / 2 - 0.5f) * 0.4f,
+                    0.2f + layer * 0.4f);
+      add_fruit(m, p, (layer + k) % 2 ? FRUIT_MELON : FRUIT_APPLE);
+    }
+  }
+}
+
+// Mixed column stacked against one wall, which slumps across the box
+void scene_avalanche(melon_state *m) {
+  u32 seed = 3;
+  float spacing = 0.32f;
+  int n = 768;
+  for (int i = 0; i < n; ++i) {
+    int layer = i / 18;
+    int row = i / 3 % 6;
+    int col = i % 3;
+    vec3 p = vec3(-(float)BOX_WIDTH / 2.0f + (col + 0.5f) * spacing,
+                  -(float)BOX_DEPTH / 2.0f + (row + 0.5f) * spacing,
+                  0.15f + layer * spacing);
+    p.x += 0.02f * bench_rand01(&seed);
+    p.y += 0.02f * bench_rand01(&seed);
+    add_fruit(m, p, bench_rand01(&seed) < 0.5f ? FRUIT_APPLE : FRUIT_MELON);
+  }
+}
+
+// 1024 cherries packed touching, so nearly all of them merge at once and
+// what they make goes on merging up the tiers
+void scene_merge(melon_state *m) {
+  u32 seed = 5;
+  int per_row = 16;
+  float spacing = 0.078f;
+  for (int i = 0; i < MAX_FRUIT; ++i) {
+    int layer = i / (per_row * per_row);
+    vec3 p;
+    p.x = (i % per_row - per_row / 2.0f + 0.5f) * spacing;
+    p.y = (i / per_row % per_row - per_row / 2.0f + 0.5f) * spacing;
+    p.z = 0.04f + layer * spacing;
+    p.x += 0.002f * bench_rand01(&seed);
+    p.y += 0.002f * bench_rand01(&seed);
+    add_fruit(m, p, FRUIT_CHERRY);
+  }
+}
+
+// Watermelons, which don't merge, covering the floor, with cherries fired
+// down into them far faster than anything dropped from the top
+void scene_bullets(melon_state *m) {
+  u32 seed = 7;
+  int per_row = 4;
+  float spacing = 0.5f;
+  for (int i = 0; i < per_row * per_row; ++i) {
+    vec3 p = vec3((i % per_row - per_row / 2.0f + 0.5f) * spacing,
+                  (i / per_row - per_row / 2.0f + 0.5f) * spacing, 0.22f);
+    add_fruit(m, p, FRUIT_WATERMELON);
+  }
+  for (int i = 0; i < 64; ++i) {
+    vec3 p;
+    p.x = 1.8f * (bench_rand01(&seed) - 0.5f);
+    p.y = 1.8f * (bench_rand01(&seed) - 0.5f);
+    p.z = 1.0f + 0.1f * i;
+    iZ k = body_store_lookup(&m->bodies, add_fruit(m, p, FRUIT_CHERRY));
+    m->bodies.vz[k] = -20.0f;
+  }
+}
+
+int bench_compare_u64(const void *a, const void *b) {
+  u64 x = *(const u64 *)a;
+  u64 y = *(const u64 *)b;
+  return (x > y) - (x < y);
+}
+
+void bench_scene(arena *mem, const char *name, void (*setup)(melon_state *),
+                 physics_solver solver) {
+  int ticks = 600;
+
+  arena scratch = *mem;
+  melon_state game{};
+  melon_init(&game, &scratch, solver);
+  setup(&game);
+
+  u64 *tick_ns = arena_push<u64>(&scratch, ticks);
+  int total_substeps = 0;
+  int max_substeps = 0;
+  float max_penetration = 0.0f;
+  int settled = -1; // The tick everything was asleep by
+  // Ticks' peak use of the arena, jobs' scratch is in arena_report
+  arena_new_frame(&scratch);
+
+  for (int t = 0; t < ticks; ++t) {
+    arena frame = scratch;
+    renderer_input ri;
+    u64 t0 = bench_now_ns();
+    melon_tick(&game, &ri, &frame);
+    tick_ns[t] = bench_now_ns() - t0;
+    total_substeps += ri.substeps;
+    max_substeps = glm::max(max_substeps, ri.substeps);
+    max_penetration = glm::max(max_penetration, game.stats.max_penetration);
+    if (settled < 0 && ri.num_awake == 0) {
+      settled = t;
+    }
+  }
+  iZ touched = scratch.block->frame_peak.load() - arena_used(&scratch);
+
+  u64 total = 0;
+  for (int t = 0; t < ticks; ++t) {
+    total += tick_ns[t];
+  }
+  qsort(tick_ns, (uZ)ticks, sizeof(u64), bench_compare_u64);
+
+  // Centres that ended up outside the container
+  iZ n = game.bodies.num;
+  iZ escaped = 0;
+  vec3 box = game.physics.box;
+  for (iZ i = 0; i < n; ++i) {
+    vec3 p = load_body(&game.bodies, i).body.position;
+    escaped += fabsf(p.x) > box.x / 2.0f || fabsf(p.y) > box.y / 2.0f ||
+               p.z < 0.0f;
+  }
+
+  double body_substeps = (double)n * total_substeps;
+  printf("scene name=%s solver=%s bodies=%td ticks=%d mean_substeps=%.2f "
+         "max_substeps=%d threads=%d ns_per_body_substep=%.1f p50_us=%.1f "
+         "p99_us=%.1f peak_arena_kb=%td awake=%td settled_by=%d "
+         "max_penetration=%.4f escaped=%td checksum=%016llx\n",
+         name, TABLE_solver_name[solver], n, ticks,
+         (double)total_substeps / ticks, max_substeps,
+         game.jobs->num_threads,
+         (double)total / body_substeps, tick_ns[ticks / 2] / 1e3,
+         tick_ns[ticks * 99 / 100] / 1e3, touched >> 10,
+         count_awake(&game.bodies), settled, (double)max_penetration, escaped,
+         (unsigned long long)body_store_checksum(&game.bodies));
+  free_job_pool(game.jobs);
+}
+
+void bench_scenes(arena *mem) {
+  for (int solver = 0; solver < PHYSICS_SOLVERS; ++solver) {
+    physics_solver s = (physics_solver)solver;
+    bench_scene(mem, "drop", scene_drop, s);
+    bench_scene(mem, "tower", scene_tower, s);
+    bench_scene(mem, "avalanche", scene_avalanche, s);
+    bench_scene(mem, "merge", scene_merge, s);
+    bench_scene(mem, "bullets", scene_bullets, s);
+  }
+}
+
+struct bench_entry {
+  const char *name;
+  void (*run)(arena *);
+};
+
+// With no arguments runs everything, otherwise just the benches named
+int main(int argc, char **argv) {
+  arena program_memory = new_arena(ARENA_RESERVE(16_GB, 64_MB), "program");
+
+  melon_state game{};
+  melon_init(&game, &program_memory, SOLVER_IMPULSE);
+  free_job_pool(game.jobs);
+
+  bench_entry benches[] = {
+      {"broadphase", bench_broadphase}, {"narrowphase", bench_narrowphase},
+      {"kernels", bench_kernels},       {"handles", bench_handles},
+      {"settle", bench_settle},         {"threads", bench_threads},
+      {"scenes", bench_scenes},         {"instances", bench_instances},
+      {"culling", bench_culling},
+  };
+  for (bench_entry &b : benches) {
+    bool run = argc < 2;
+    for (int i = 1; i < argc; ++i) {
+      run |= !strcmp(argv[i], b.name);
+    }
+    if (run) {
+      b.run(&program_memory);
+      fflush(stdout);
+    }
+  }
+  arena_report();
+
+  return 0;
+}
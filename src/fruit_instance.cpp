@@ -0,0 +1,159 @@
+#include "fruit_instance.h"
+
+#define SQRT_HALF 0.70710678f
+
+u32 pack_orientation(quat orientation) {
+  float q[4] = {orientation.x, orientation.y, orientation.z, orientation.w};
+
+  int largest = 0;
+  for (int k = 1; k < 4; ++k) {
+    largest = (fabsf(q[k]) > fabsf(q[largest])) ? k : largest;
+  }
+  // q and -q are the same rotation, pick the one with the largest positive
+  float sign = (q[largest] < 0.0f) ? -1.0f : 1.0f;
+
+  u32 packed = (u32)largest << 30;
+  int shift = 0;
+  for (int k = 0; k < 4; ++k) {
+    if (k == largest) {
+      continue;
+    }
+    float unit = glm::clamp(sign * q[k] / SQRT_HALF, -1.0f, 1.0f);
+    u32 bits = (u32)(unit * 511.5f + 512.0f);
+    packed |= glm::min(bits, 1023u) << shift;
+    shift += 10;
+  }
+  return packed;
+}
+
+mat3 unpack_orientation(u32 packed) {
+  int largest = (int)(packed >> 30);
+  float q[4];
+  float sum2 = 0.0f;
+  int shift = 0;
+  for (int k = 0; k < 4; ++k) {
+    if (k == largest) {
+      continue;
+    }
+    // Same mapping fruit.vert uses
+    float bits = (float)((packed >> shift) & 1023u);
+    q[k] = (bits / 1023.0f * 2.0f - 1.0f) * SQRT_HALF;
+    sum2 += q[k] * q[k];
+    shift += 10;
+  }
+  q[largest] = sqrtf(glm::max(1.0f - sum2, 0.0f));
+
+  float x = q[0], y = q[1], z = q[2], w = q[3];
+  vec3 col0(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y));
+  vec3 col1(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x));
+  vec3 col2(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y));
+  return mat3(col0, col1, col2);
+}
+
+fruit_instance pack_fruit_instance(const fruit_body *f) {
+  fruit_instance result;
+  result.position[0] = f->body.position.x;
+  result.position[1] = f->body.position.y;
+  result.position[2] = f->body.position.z;
+  result.orientation = pack_orientation(f->body.orientation);
+  result.id = (u8)f->id;
+  result.pad[0] = result.pad[1] = result.pad[2] = 0;
+  return result;
+}
+
+void pack_fruit_instances(const fruit_body *fruit, const bool *moved,
+                          iZ num, fruit_instance *instances) {
+  for (iZ i = 0; i < num; ++i) {
+    if (moved[i]) {
+      instances[i] = pack_fruit_instance(&fruit[i]);
+    }
+  }
+}
+
+/*     ======  Draw lists ====== */
+
+iZ fruit_lod_verts(int lod) {
+  const fruit_lod &l = TABLE_fruit_lod[lod];
+  return 2 + l.ndivs_u * l.ndivs_v;
+}
+iZ fruit_lod_tris(int lod) {
+  const fruit_lod &l = TABLE_fruit_lod[lod];
+  return 2 * l.ndivs_u * l.ndivs_v;
+}
+
+fruit_draw_list new_fruit_draw_list(arena *mem, iZ max_fruit) {
+  ASSERT(max_fruit <= 1 << 16);
+  fruit_draw_list list;
+  list.slot_fruit = arena_push<u16>(mem, max_fruit);
+  for (iZ &start : list.lod_start) {
+    start = 0;
+  }
+  return list;
+}
+
+void build_fruit_draw_list(fruit_draw_list *list,
+                           const fruit_instance *instances, iZ num,
+                           const fruit_view *view, arena *mem_temp) {
+  arena scratch = *mem_temp;
+
+  // Frustum planes straight from the rows of the matrix, pointing in
+  // (Gribb & Hartmann). Unnormalised, so radii get scaled by |n|.
+  const mat4 &M = view->proj_view;
+  vec4 row[4];
+  for (int r = 0; r < 4; ++r) {
+    row[r] = vec4(M[0][r], M[1][r], M[2][r], M[3][r]);
+  }
+  vec4 planes[6] = {row[3] + row[0], row[3] - row[0], row[3] + row[1],
+                    row[3] - row[1], row[3] + row[2], row[3] - row[2]};
+  float plane_scale[6];
+  for (int k = 0; k < 6; ++k) {
+    plane_scale[k] = glm::length(vec3(planes[k]));
+  }
+
+  float radius[FRUIT_TYPES];
+  for (u32 t = 0; t < FRUIT_TYPES; ++t) {
+    radius[t] = TABLE_fruit_type[t].bound * FRUIT_OUTLINE_SCALE;
+  }
+
+  // LOD of each fruit, or -1 if it's off screen, then a counting sort
+  i8 *lod = arena_push<i8>(&scratch, num);
+  iZ count[FRUIT_LODS] = {};
+  for (iZ i = 0; i < num; ++i) {
+    const fruit_instance &f = instances[i];
+    vec3 p = vec3(f.position[0], f.position[1], f.position[2]);
+    ASSERT(f.id < FRUIT_TYPES);
+    float r = radius[f.id];
+
+    bool visible = true;
+    for (int k = 0; k < 6; ++k) {
+      const vec4 &n = planes[k];
+      visible &= n.x * p.x + n.y * p.y + n.z * p.z + n.w >=
+                 -r * plane_scale[k];
+    }
+    if (!visible) {
+      lod[i] = -1;
+      continue;
+    }
+
+    float dist = glm::length(p - view->camera_pos);
+    float pixels = r * view->pixel_scale / glm::max(dist, 1e-3f);
+    int l = 0;
+    while (l < FRUIT_LODS - 1 && pixels < TABLE_fruit_lod[l].min_pixels) {
+      ++l;
+    }
+    lod[i] = (i8)l;
+    ++count[l];
+  }
+
+  iZ next[FRUIT_LODS];
+  list->lod_start[0] = 0;
+  for (int l = 0; l < FRUIT_LODS; ++l) {
+    next[l] = list->lod_start[l];
+    list->lod_start[l + 1] = list->lod_start[l] + count[l];
+  }
+  for (iZ i = 0; i < num; ++i) {
+    if (lod[i] >= 0) {
+      list->slot_fruit[next[lod[i]]++] = (u16)i;
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "melongame.h"
+#include "physics.h"
+#include "types.h"
+
+/*     ======  Fruit instances ======
+ * What the GPU gets per fruit, 20 bytes instead of fruit_body's 32.
+ *
+ * The orientation is a unit quaternion stored as its smallest three
+ * components, in the layout of GL_UNSIGNED_INT_2_10_10_10_REV. The top two
+ * bits say which of x, y, z, w was left out, and the other three follow in
+ * order, 10 bits each, mapped from [-1/sqrt(2), 1/sqrt(2)]. The one left out
+ * is the largest, so it's made positive and rebuilt from the rest.
+ * shaders/fruit.vert does the unpacking.
+ */
+
+struct fruit_instance {
+  float position[3];
+  u32 orientation;
+  u8 id;
+  u8 pad[3];
+};
+
+static_assert(sizeof(fruit_instance) == 20);
+
+fruit_instance pack_fruit_instance(const fruit_body *);
+
+// Packs the fruit with moved set, leaving the others as they were
+void pack_fruit_instances(const fruit_body *, const bool *moved, iZ num,
+                          fruit_instance *);
+
+// The rotation pack_fruit_instance kept, for checking it
+mat3 unpack_orientation(u32 packed);
+
+/*     ======  Draw lists ======
+ * Which fruit get drawn, and with which sphere. Fruit whose bounding sphere
+ * is outside the view frustum are dropped, the rest are bucketed by how many
+ * pixels tall they come out, so each LOD is one instanced draw over a
+ * contiguous run of slots.
+ */
+
+struct fruit_lod {
+  int ndivs_u; // As make_UV_sphere_mesh_verts
+  int ndivs_v;
+  float min_pixels; // Projected radius it's used from
+};
+
+#define FRUIT_LODS 3
+
+const fruit_lod TABLE_fruit_lod[FRUIT_LODS] = {
+    {.ndivs_u = 32, .ndivs_v = 16, .min_pixels = 48.0f},
+    {.ndivs_u = 16, .ndivs_v = 8, .min_pixels = 16.0f},
+    {.ndivs_u = 8, .ndivs_v = 4, .min_pixels = 0.0f},
+};
+
+iZ fruit_lod_verts(int lod);
+iZ fruit_lod_tris(int lod);
+
+// Outlines are drawn this much bigger, culling has to allow for them
+#define FRUIT_OUTLINE_SCALE 1.05f
+
+struct fruit_view {
+  mat4 proj_view;
+  vec3 camera_pos;
+  float pixel_scale; // Viewport height / (2 tan(fov_y / 2))
+};
+
+struct fruit_draw_list {
+  u16 *slot_fruit; // Fruit index in each slot
+  // First slot of each LOD, with lod_start[FRUIT_LODS] slots used in all
+  iZ lod_start[FRUIT_LODS + 1];
+};
+
+fruit_draw_list new_fruit_draw_list(arena *, iZ max_fruit);
+void build_fruit_draw_list(fruit_draw_list *, const fruit_instance *, iZ num,
+                           const fruit_view *, arena *mem_temp);
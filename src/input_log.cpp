@@ -0,0 +1,235 @@
+#include "input_log.h"
+
+input_log new_input_log(arena *mem, iZ max_events) {
+  input_log log;
+  log.physics = {};
+  log.num_ticks = 0;
+  log.checksum = 0;
+  log.truncated = false;
+  log.events = new_array<input_event>(mem, max_events);
+  log.substeps = new_array<substep_run>(mem, max_events);
+  return log;
+}
+
+void input_log_full(input_log *log) {
+  if (!log->truncated) {
+    puts("Input log full, further events won't be recorded");
+  }
+  log->truncated = true;
+}
+
+void input_log_push(input_log *log, u64 tick, input_event_type type) {
+  if (log->events.isfull()) {
+    input_log_full(log);
+    return;
+  }
+  log->events.push({.tick = tick, .type = type});
+}
+
+void input_log_push_substeps(input_log *log, u64 tick, int substeps) {
+  ASSERT(substeps > 0 && substeps < 256);
+  if (log->substeps.size() && log->substeps.tail[-1].substeps == substeps) {
+    return;
+  }
+  if (log->substeps.isfull()) {
+    input_log_full(log);
+    return;
+  }
+  log->substeps.push({.tick = tick, .substeps = (u8)substeps});
+}
+
+int input_log_substeps(const input_log *log, u64 tick,
+                       const substep_run **run) {
+  if (*run == log->substeps.tail || (*run)->tick > tick) {
+    return 0;
+  }
+  while (*run + 1 < log->substeps.tail && (*run)[1].tick <= tick) {
+    ++*run;
+  }
+  return (*run)->substeps;
+}
+
+/*     ======  Serialisation ====== */
+
+void put_u32(u8 **p, u32 x) {
+  for (int i = 0; i < 4; ++i) {
+    *(*p)++ = (u8)(x >> (8 * i));
+  }
+}
+void put_u64(u8 **p, u64 x) {
+  put_u32(p, (u32)x);
+  put_u32(p, (u32)(x >> 32));
+}
+void put_varint(u8 **p, u64 x) {
+  while (x >= 0x80) {
+    *(*p)++ = (u8)(x | 0x80);
+    x >>= 7;
+  }
+  *(*p)++ = (u8)x;
+}
+
+// Readers check against end and leave *p past it on a short read
+u32 get_u32(u8 **p, u8 *end) {
+  u32 x = 0;
+  for (int i = 0; i < 4; ++i, ++*p) {
+    x |= (*p < end) ? (u32)**p << (8 * i) : 0;
+  }
+  return x;
+}
+u64 get_u64(u8 **p, u8 *end) {
+  u64 lo = get_u32(p, end);
+  return lo | (u64)get_u32(p, end) << 32;
+}
+u64 get_varint(u8 **p, u8 *end) {
+  u64 x = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    u8 b = *(*p)++;
+    x |= (u64)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return x;
+    }
+  }
+  *p = end + 1;
+  return x;
+}
+
+#define INPUT_LOG_HEADER_BYTES (4 + 4 + 4 + 4 + 4 + 4 + 8 + 8 + 1 + 8)
+
+bool save_input_log(const input_log *log, const char *path,
+                    arena *mem_temp) {
+  arena scratch = *mem_temp;
+  iZ num_events = log->events.size();
+  iZ num_runs = log->substeps.size();
+  // Varints take at most 10 bytes
+  iZ max_bytes = INPUT_LOG_HEADER_BYTES + 11 * num_events + 8 + 11 * num_runs;
+  u8 *base = arena_push<u8>(&scratch, max_bytes);
+  u8 *p = base;
+
+  put_u32(&p, INPUT_LOG_MAGIC);
+  put_u32(&p, INPUT_LOG_VERSION);
+  put_u32(&p, (u32)log->physics.solver);
+  put_u32(&p, (u32)log->physics.substeps);
+  put_u32(&p, (u32)log->physics.max_substeps);
+  put_u32(&p, (u32)log->physics.iterations);
+  put_u64(&p, log->num_ticks);
+  put_u64(&p, log->checksum);
+  *p++ = log->truncated;
+  put_u64(&p, (u64)num_events);
+
+  u64 tick = 0;
+  for (iZ i = 0; i < num_events; ++i) {
+    input_event e = log->events.base[i];
+    *p++ = e.type;
+    put_varint(&p, e.tick - tick);
+    tick = e.tick;
+  }
+
+  put_u64(&p, (u64)num_runs);
+  tick = 0;
+  for (iZ i = 0; i < num_runs; ++i) {
+    substep_run r = log->substeps.base[i];
+    put_varint(&p, r.tick - tick);
+    *p++ = r.substeps;
+    tick = r.tick;
+  }
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    printf("Couldn't open %s for writing\n", path);
+    return false;
+  }
+  bool ok = fwrite(base, 1, (uZ)(p - base), f) == (uZ)(p - base);
+  ok &= fclose(f) == 0;
+  if (!ok) {
+    printf("Couldn't write %s\n", path);
+  }
+  return ok;
+}
+
+bool load_input_log(input_log *log, const char *path, arena *mem) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("Couldn't open %s\n", path);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (size < 0) {
+    fclose(f);
+    printf("Couldn't read %s\n", path);
+    return false;
+  }
+
+  // Every event and run takes at least two bytes, which bounds how many
+  // there are
+  *log = new_input_log(mem, size / 2);
+  arena scratch = *mem;
+  u8 *base = arena_push<u8>(&scratch, size);
+  bool read_ok = fread(base, 1, (uZ)size, f) == (uZ)size;
+  fclose(f);
+  u8 *end = base + size;
+  u8 *p = base;
+
+  bool ok = read_ok && get_u32(&p, end) == INPUT_LOG_MAGIC &&
+            get_u32(&p, end) == INPUT_LOG_VERSION;
+  if (!ok) {
+    printf("%s isn't a version %d input log\n", path, INPUT_LOG_VERSION);
+    return false;
+  }
+
+  u32 solver = get_u32(&p, end);
+  if (solver >= PHYSICS_SOLVERS) {
+    printf("%s was recorded with an unknown solver\n", path);
+    return false;
+  }
+  physics_params physics;
+  physics.solver = (physics_solver)solver;
+  physics.substeps = (int)get_u32(&p, end);
+  physics.max_substeps = (int)get_u32(&p, end);
+  physics.iterations = (int)get_u32(&p, end);
+  u64 num_ticks = get_u64(&p, end);
+  u64 checksum = get_u64(&p, end);
+  bool truncated = (p < end) ? *p != 0 : false;
+  ++p;
+  u64 num_events = get_u64(&p, end);
+  if (p > end || num_events > (u64)(end - p) / 2) {
+    printf("%s is cut short\n", path);
+    return false;
+  }
+
+  log->physics = physics;
+  log->num_ticks = num_ticks;
+  log->checksum = checksum;
+  log->truncated = truncated;
+
+  u64 tick = 0;
+  for (u64 i = 0; i < num_events; ++i) {
+    u8 type = (p < end) ? *p : 0xFF;
+    ++p;
+    tick += get_varint(&p, end);
+    if (p > end || type > INPUT_MOUSEUP) {
+      printf("%s has a bad event %llu\n", path, (unsigned long long)i);
+      return false;
+    }
+    log->events.push({.tick = tick, .type = (input_event_type)type});
+  }
+
+  u64 num_runs = get_u64(&p, end);
+  if (p > end || num_runs > (u64)(end - p) / 2) {
+    printf("%s is cut short\n", path);
+    return false;
+  }
+  tick = 0;
+  for (u64 i = 0; i < num_runs; ++i) {
+    tick += get_varint(&p, end);
+    u8 substeps = (p < end) ? *p : 0;
+    ++p;
+    if (p > end || substeps == 0) {
+      printf("%s has a bad substep run %llu\n", path, (unsigned long long)i);
+      return false;
+    }
+    log->substeps.push({.tick = tick, .substeps = substeps});
+  }
+  return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "physics.h"
+#include "types.h"
+
+/*     ======  Input log ======
+ * Every input event the game saw, and the tick it was applied on (before
+ * that tick's melon_tick). Replaying the same events on the same ticks from
+ * melon_init, with the same solver and physics_params, gives the same game,
+ * which the final state checksum confirms.
+ *
+ * The substeps melon_tick picked are kept too, as runs of ticks with the same
+ * count. They follow from the state, so a replay that picks differently has
+ * already diverged, well before the checksum at the end says so.
+ *
+ * On disk it's a fixed header followed by one type byte and a varint tick
+ * delta per event, then a count and a varint tick delta and substeps byte
+ * per run, all little endian.
+ */
+
+enum input_event_type : u8 {
+  INPUT_MOUSEMOTION,
+  INPUT_MOUSEDOWN,
+  INPUT_MOUSEUP,
+};
+
+struct input_event {
+  u64 tick;
+  input_event_type type;
+};
+
+// Every tick from this one until the next run's took this many substeps
+struct substep_run {
+  u64 tick;
+  u8 substeps;
+};
+
+struct input_log {
+  physics_params physics;
+  u64 num_ticks;
+  u64 checksum; // body_store_checksum after the last tick
+  bool truncated;
+
+  array<input_event> events;
+  array<substep_run> substeps;
+};
+
+#define INPUT_LOG_MAGIC   0x524E4C4Du // "MLNR"
+#define INPUT_LOG_VERSION 5
+
+// Room for max_events events and as many substep runs
+input_log new_input_log(arena *, iZ max_events);
+void input_log_push(input_log *, u64 tick, input_event_type);
+void input_log_push_substeps(input_log *, u64 tick, int substeps);
+
+// What the log says tick took, walking *run forward from where it was
+int input_log_substeps(const input_log *, u64 tick, const substep_run **run);
+
+bool save_input_log(const input_log *, const char *path, arena *mem_temp);
+bool load_input_log(input_log *, const char *path, arena *);
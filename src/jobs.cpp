@@ -0,0 +1,150 @@
+#include "jobs.h"
+#include "trace.h"
+
+#include <new>
+
+bool job_pool_take(job_pool *pool, int worker, iZ *job) {
+  // Own deque from the back
+  {
+    job_deque *d = &pool->deques[worker];
+#if JOBS_THREADED
+    std::lock_guard<std::mutex> guard(d->lock);
+#endif
+    if (d->front < d->back) {
+      *job = --d->back;
+      return true;
+    }
+  }
+
+  // Then steal from the front of the others
+  for (int k = 1; k < pool->num_threads; ++k) {
+    job_deque *d = &pool->deques[(worker + k) % pool->num_threads];
+#if JOBS_THREADED
+    std::lock_guard<std::mutex> guard(d->lock);
+#endif
+    if (d->front < d->back) {
+      *job = d->front++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void job_pool_work(job_pool *pool, int worker) {
+  iZ job;
+  while (job_pool_take(pool, worker, &job)) {
+    TRACE_SCOPE("job");
+    // Fresh scratch for every job
+    arena *scratch = thread_scratch();
+    arena_temp temp = arena_temp_begin(scratch);
+    pool->fn(pool->data, job, scratch);
+    arena_temp_end(temp);
+#if JOBS_THREADED
+    pool->remaining.fetch_sub(1, std::memory_order_release);
+#endif
+  }
+}
+
+#if JOBS_THREADED
+void job_pool_worker_main(job_pool *pool, int worker) {
+  u64 seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(pool->wake_lock);
+      pool->wake.wait(guard, [&] {
+        return pool->quit || pool->generation != seen;
+      });
+      if (pool->quit) {
+        return;
+      }
+      seen = pool->generation;
+    }
+    job_pool_work(pool, worker);
+  }
+}
+#endif
+
+int job_pool_default_threads() {
+#if JOBS_THREADED
+  int cores = (int)std::thread::hardware_concurrency();
+  return glm::clamp(cores, 1, JOBS_MAX_THREADS);
+#else
+  return 1;
+#endif
+}
+
+job_pool *new_job_pool(arena *mem, int num_threads) {
+  ASSERT(num_threads > 0 && num_threads <= JOBS_MAX_THREADS);
+  job_pool *pool = new (arena_push<job_pool>(mem, 1)) job_pool;
+  pool->num_threads = num_threads;
+  pool->fn = nullptr;
+  pool->data = nullptr;
+  for (job_deque &d : pool->deques) {
+    d.front = d.back = 0;
+  }
+#if JOBS_THREADED
+  pool->remaining = 0;
+  pool->generation = 0;
+  pool->quit = false;
+  for (int w = 1; w < num_threads; ++w) {
+    pool->threads[w] = std::thread(job_pool_worker_main, pool, w);
+  }
+#else
+  pool->num_threads = 1;
+#endif
+  return pool;
+}
+
+void free_job_pool(job_pool *pool) {
+#if JOBS_THREADED
+  {
+    std::lock_guard<std::mutex> guard(pool->wake_lock);
+    pool->quit = true;
+  }
+  pool->wake.notify_all();
+  for (int w = 1; w < pool->num_threads; ++w) {
+    pool->threads[w].join();
+  }
+#endif
+  pool->~job_pool();
+}
+
+void job_pool_run(job_pool *pool, job_fn *fn, void *data, iZ num_jobs) {
+  if (num_jobs == 0) {
+    return;
+  }
+
+  int T = pool->num_threads;
+  pool->fn = fn;
+  pool->data = data;
+
+#if JOBS_THREADED
+  pool->remaining.store(num_jobs, std::memory_order_relaxed);
+#endif
+  for (int w = 0; w < T; ++w) {
+    job_deque *d = &pool->deques[w];
+#if JOBS_THREADED
+    std::lock_guard<std::mutex> guard(d->lock);
+#endif
+    d->front = num_jobs * w / T;
+    d->back = num_jobs * (w + 1) / T;
+  }
+
+#if JOBS_THREADED
+  if (T > 1) {
+    {
+      std::lock_guard<std::mutex> guard(pool->wake_lock);
+      pool->generation++;
+    }
+    pool->wake.notify_all();
+  }
+#endif
+
+  job_pool_work(pool, 0);
+
+#if JOBS_THREADED
+  while (pool->remaining.load(std::memory_order_acquire) > 0) {
+    std::this_thread::yield();
+  }
+#endif
+}
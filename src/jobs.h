@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.h"
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define JOBS_THREADED 0
+#else
+#define JOBS_THREADED 1
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+/*     ======  Job pool ======
+ * A fixed set of worker threads plus the calling thread (worker 0). Each run
+ * hands out num_jobs indices, split evenly over per-worker deques. Workers
+ * pop from the back of their own deque, and once it's empty steal from the
+ * front of the others'.
+ *
+ * Jobs get their thread's thread_scratch, reset for every job.
+ *
+ * Without threads (single threaded WASM) everything runs on the caller.
+ */
+
+#define JOBS_MAX_THREADS 16
+
+typedef void job_fn(void *data, iZ job, arena *scratch);
+
+struct job_deque {
+#if JOBS_THREADED
+  std::mutex lock;
+#endif
+  iZ front;
+  iZ back; // One past the last job
+};
+
+struct job_pool {
+  int num_threads;
+
+  // Current run, only touched by workers once they've popped a job
+  job_fn *fn;
+  void *data;
+  job_deque deques[JOBS_MAX_THREADS];
+
+#if JOBS_THREADED
+  std::thread threads[JOBS_MAX_THREADS];
+  std::atomic<iZ> remaining;
+
+  std::mutex wake_lock;
+  std::condition_variable wake;
+  u64 generation;
+  bool quit;
+#endif
+};
+
+// One per core, up to JOBS_MAX_THREADS
+int job_pool_default_threads();
+
+job_pool *new_job_pool(arena *, int num_threads);
+void free_job_pool(job_pool *);
+
+void job_pool_run(job_pool *, job_fn *fn, void *data, iZ num_jobs);
@@ -1,76 +1,307 @@
 #include "melongame.h"
 #include "physics.h"
+#include "trace.h"
 #include "types.h"
 
 float gravity = 10;
 
-void add_fruit(melon_state *m, vec3 pos, int fruit_id) {
-  rigidbody body;
-  body.position = pos;
-  body.orientation = mat3(1.0f);
+body_handle add_fruit(melon_state *m, vec3 pos, int fruit_id) {
+  return body_store_push(&m->bodies, pos, quat(1.0f, 0.0f, 0.0f, 0.0f),
+                         (u32)fruit_id);
+}
+
+void melon_init(melon_state *m, arena *mem_perm, physics_solver solver) {
+  m->bodies = new_body_store(mem_perm, MAX_FRUIT);
+  m->contacts = new_array<cached_contact>(
+      mem_perm, MAX_FRUIT * (BROADPHASE_MAX_PAIRS_PER_BODY + CONTAINER_PLANES));
+
+  m->physics.solver = solver;
+  m->physics.substeps = 2;
+  m->physics.max_substeps = 8;
+  m->physics.iterations = 8;
+  m->physics.box = vec3(BOX_WIDTH, BOX_DEPTH, BOX_HEIGHT);
+  // The last type has nothing to merge into
+  m->physics.merge_ids = FRUIT_TYPES - 1;
 
-  body_dynamics dynamics;
-  dynamics.linear_velocity = vec3(0.0f);
-  dynamics.angular_velocity = vec3(0.0f);
+  m->jobs = new_job_pool(mem_perm, job_pool_default_threads());
 
-  fruit_body f;
-  f.id = (u32)fruit_id;
-  f.body = body;
+  m->tick = 0;
+  m->recording = nullptr;
 
-  m->fruit.push(f);
-  m->fruit_dynamics.push(dynamics);
+  m->substeps = m->physics.substeps;
+  m->stats = {.max_speed = 0.0f, .max_penetration = 0.0f, .dropped_pairs = 0};
+  m->replaced = new_array<u32>(mem_perm, MAX_FRUIT);
+
+  m->accumulator = 0.0f;
+  m->prev_fruit = arena_push<fruit_body>(mem_perm, MAX_FRUIT);
+  m->curr_fruit = arena_push<fruit_body>(mem_perm, MAX_FRUIT);
+  m->curr_moved = arena_push<bool>(mem_perm, MAX_FRUIT);
+  m->curr_num_fruit = 0;
+  m->curr_num_awake = 0;
 }
 
-void melon_init(melon_state *m, arena *mem_perm) {
+int compare_body_pairs(const void *a, const void *b) {
+  const body_pair *x = (const body_pair *)a;
+  const body_pair *y = (const body_pair *)b;
+  u64 kx = (u64)x->a << 32 | x->b;
+  u64 ky = (u64)y->a << 32 | y->b;
+  return (kx > ky) - (kx < ky);
+}
 
-  // Calculate fruit_type derived properties
-  int num_types = sizeof(TABLE_fruit_type) / sizeof(TABLE_fruit_type[0]);
-  for (int i = 0; i < num_types; ++i) {
-    const fruit_type &f = TABLE_fruit_type[i];
+// Merges the pairs the tick's steps found, lowest first and each fruit at
+// most once, into the next type up in the first one's slot. The second ones
+// all go in one body_store_remove, so the contact cache and moved flags are
+// only remapped once however many merge. Gives the moved flags for the
+// fruit left, with every slot that now holds a different fruit set.
+bool *merge_fruit(melon_state *m, array<body_pair> *pairs, const bool *moved,
+                  arena *frame_mem) {
+  TRACE_SCOPE("merge");
+  body_store *s = &m->bodies;
+  iZ num = s->num;
+  bool *result = arena_push<bool>(frame_mem, num);
+  arena scratch = *frame_mem;
 
-    float r1, r2, r3;
-    r1 = f.radii.x;
-    r2 = f.radii.y;
-    r3 = f.radii.z;
+  // Pairs come in step by step, each step's in order
+  qsort(pairs->base, (uZ)pairs->size(), sizeof(body_pair), compare_body_pairs);
 
-    float mass, density, volume;
-    density = f.density;
-    volume = 4.0f * PI * r1 * r2 * r3 / 3.0f;
-    mass = density * volume;
+  u8 *merged = arena_push<u8>(&scratch, num); // 1 kept, 2 removed
+  memset(merged, 0, (uZ)num);
+  for (body_pair *p = pairs->base; p != pairs->tail; ++p) {
+    u32 a = p->a;
+    u32 b = p->b;
+    if (merged[a] || merged[b]) {
+      continue;
+    }
+    merged[a] = 1;
+    merged[b] = 2;
+    // Whatever they were resting on or under has to notice they're gone
+    wake_body(s, a);
+    wake_body(s, b);
 
-    float inv_moi_x, inv_moi_y, inv_moi_z;
-    inv_moi_x = 5.0f / (mass * (r2 * r2 + r3 * r3));
-    inv_moi_y = 5.0f / (mass * (r1 * r1 + r3 * r3));
-    inv_moi_z = 5.0f / (mass * (r1 * r1 + r2 * r2));
+    // Same type, so the same mass, and this keeps momentum
+    vec3 pa = vec3(s->px[a], s->py[a], s->pz[a]);
+    vec3 pb = vec3(s->px[b], s->py[b], s->pz[b]);
+    vec3 v = (load_linear_velocity(s, a) + load_linear_velocity(s, b)) / 2.0f;
+    vec3 w = (vec3(s->wx[a], s->wy[a], s->wz[a]) +
+              vec3(s->wx[b], s->wy[b], s->wz[b])) /
+             2.0f;
+    body_store_set(s, a, (pa + pb) / 2.0f, load_body(s, a).body.orientation,
+                   s->id[a] + 1);
+    s->vx[a] = v.x;
+    s->vy[a] = v.y;
+    s->vz[a] = v.z;
+    s->wx[a] = w.x;
+    s->wy[a] = w.y;
+    s->wz[a] = w.z;
+  }
 
-    TABLE_fruit_type[i].volume = volume;
-    TABLE_fruit_type[i].inv_mass = 1.0f / mass;
-    TABLE_fruit_type[i].inv_moi = mat3( //
-        inv_moi_x, 0.0f, 0.0f,          //
-        0.0f, inv_moi_y, 0.0f,          //
-        0.0f, 0.0f, inv_moi_z);
+  u32 *removed = arena_push<u32>(&scratch, num);
+  iZ num_removed = 0;
+  for (iZ i = 0; i < num; ++i) {
+    if (merged[i] == 2) {
+      removed[num_removed++] = (u32)i;
+    }
   }
+  u32 *remap = arena_push<u32>(&scratch, num);
+  body_store_remove(s, removed, num_removed, remap);
 
-  m->fruit = new_array<fruit_body>(mem_perm, MAX_FRUIT);
-  m->fruit_dynamics = new_array<body_dynamics>(mem_perm, MAX_FRUIT);
+  // Nothing the smaller fruit touched is any use to the bigger one
+  u32 *contact_remap = arena_push<u32>(&scratch, num);
+  for (iZ i = 0; i < num; ++i) {
+    contact_remap[i] = merged[i] == 1 ? BODY_REMOVED : remap[i];
+  }
+  remap_contacts(&m->contacts, contact_remap);
+
+  for (iZ i = 0; i < num; ++i) {
+    u32 slot = remap[i];
+    if (slot == BODY_REMOVED) {
+      continue;
+    }
+    bool replaced = merged[i] == 1 || slot != (u32)i;
+    result[slot] = moved[i] || replaced;
+    if (replaced) {
+      m->replaced.push(slot);
+    }
+  }
+  return result;
 }
 
 void melon_tick(melon_state *m, renderer_input *ri, arena *frame_mem) {
-  int physics_substeps = 10;
+  TRACE_SCOPE("tick");
+  m->replaced.clear();
+  iZ num_fruit = m->bodies.num;
+  merge_queue merges;
+  merges.pairs = new_array<body_pair>(frame_mem, MELON_MAX_MERGES);
+  merges.queued = arena_push<u8>(frame_mem, num_fruit);
+  memset(merges.queued, 0, (uZ)num_fruit);
+  ri->moved = arena_push<bool>(frame_mem, num_fruit);
+  for (iZ i = 0; i < num_fruit; ++i) {
+    ri->moved[i] = m->bodies.awake[i] != 0.0f;
+  }
+
+  int physics_substeps =
+      choose_substeps(&m->physics, m->stats, m->substeps, MELON_TICK_DT);
+  if (m->recording) {
+    input_log_push_substeps(m->recording, m->tick, physics_substeps);
+  }
+
+  physics_step_stats stats = {
+      .max_speed = 0.0f, .max_penetration = 0.0f, .dropped_pairs = 0};
   for (int i = 0; i < physics_substeps; ++i) {
-    physics_step(m->fruit.base, m->fruit_dynamics.base, m->fruit.size(),
-                 1.0f / 60 / physics_substeps);
+    physics_step_stats step =
+        physics_step(&m->bodies, &m->contacts, &m->physics, m->jobs,
+                     MELON_TICK_DT / physics_substeps, &merges, frame_mem);
+    stats.max_speed = glm::max(stats.max_speed, step.max_speed);
+    stats.max_penetration =
+        glm::max(stats.max_penetration, step.max_penetration);
+    stats.dropped_pairs += step.dropped_pairs;
+    for (iZ j = 0; j < num_fruit; ++j) {
+      ri->moved[j] |= m->bodies.awake[j] != 0.0f;
+    }
+  }
+  m->substeps = physics_substeps;
+  m->stats = stats;
+  if (stats.dropped_pairs) {
+    // Those contacts went unsolved, the fruit in them will overlap
+    printf("Tick %llu dropped %td broadphase pairs\n",
+           (unsigned long long)m->tick, stats.dropped_pairs);
   }
 
-  ri->fruit = m->fruit.base;
-  ri->num_fruit = m->fruit.size();
+  if (!merges.pairs.isempty()) {
+    ri->moved = merge_fruit(m, &merges.pairs, ri->moved, frame_mem);
+    num_fruit = m->bodies.num;
+  }
+
+  ri->fruit = arena_push<fruit_body>(frame_mem, num_fruit);
+  for (iZ i = 0; i < num_fruit; ++i) {
+    ri->fruit[i] = load_body(&m->bodies, i);
+  }
+  ri->num_fruit = num_fruit;
+  ri->num_awake = count_awake(&m->bodies);
+  ri->substeps = physics_substeps;
+
+  m->tick++;
 }
 
-void melon_mousemotion(melon_state *m) {}
+// Between two orientations a tick apart, close enough to draw. q and -q are
+// the same rotation, b is flipped to whichever is nearer a.
+quat interpolate_orientation(quat a, quat b, float t) {
+  if (glm::dot(a, b) < 0.0f) {
+    b = -b;
+  }
+  return glm::normalize(a + t * (b - a));
+}
+
+void melon_advance(melon_state *m, float seconds, renderer_input *ri,
+                   arena *frame_mem) {
+  m->accumulator += glm::min(seconds, MELON_MAX_FRAME_TIME);
+
+  // Anything drawn part way through the last tick needs drawing again, as
+  // well as anything that moves in this frame's ticks
+  bool *moved = arena_push<bool>(frame_mem, MAX_FRUIT);
+  for (iZ i = 0; i < m->curr_num_fruit; ++i) {
+    moved[i] = m->curr_moved[i];
+  }
+
+  int ticks = 0;
+  while (m->accumulator >= MELON_TICK_DT) {
+    if (ticks == MELON_MAX_TICKS_PER_FRAME) {
+      m->accumulator = 0.0f;
+      break;
+    }
+    arena tick_mem = *frame_mem;
+    renderer_input tick;
+    melon_tick(m, &tick, &tick_mem);
+
+    fruit_body *prev = m->prev_fruit;
+    m->prev_fruit = m->curr_fruit;
+    m->curr_fruit = prev;
+    for (iZ i = 0; i < tick.num_fruit; ++i) {
+      // Fruit new this tick have nowhere to come from
+      if (i >= m->curr_num_fruit) {
+        m->prev_fruit[i] = tick.fruit[i];
+        moved[i] = true;
+      }
+      m->curr_fruit[i] = tick.fruit[i];
+      m->curr_moved[i] = tick.moved[i];
+      moved[i] |= tick.moved[i];
+    }
+    // Merges leave slots with other fruit in, which came from elsewhere
+    for (iZ k = 0; k < m->replaced.size(); ++k) {
+      u32 slot = m->replaced.base[k];
+      m->prev_fruit[slot] = tick.fruit[slot];
+    }
+    m->curr_num_fruit = tick.num_fruit;
+    m->curr_num_awake = tick.num_awake;
+
+    m->accumulator -= MELON_TICK_DT;
+    ++ticks;
+  }
+
+  float t = m->accumulator / MELON_TICK_DT;
+  iZ num_fruit = m->curr_num_fruit;
+  ri->fruit = arena_push<fruit_body>(frame_mem, num_fruit);
+  for (iZ i = 0; i < num_fruit; ++i) {
+    fruit_body a = m->prev_fruit[i];
+    fruit_body b = m->curr_fruit[i];
+    if (m->curr_moved[i]) {
+      b.body.position = a.body.position +
+                        t * (b.body.position - a.body.position);
+      b.body.orientation =
+          interpolate_orientation(a.body.orientation, b.body.orientation, t);
+    }
+    ri->fruit[i] = b;
+  }
+  ri->moved = moved;
+  ri->num_fruit = num_fruit;
+  ri->num_awake = m->curr_num_awake;
+  ri->substeps = m->substeps;
+}
+
+void melon_mousemotion(melon_state *m) {
+  if (m->recording) {
+    input_log_push(m->recording, m->tick, INPUT_MOUSEMOTION);
+  }
+}
 void melon_mousedown(melon_state *m) {
-  puts("New fruit");
-  add_fruit(m, vec3(0.0f, 0.0f, (float)BOX_HEIGHT), 1);
-  m->fruit.tail[-1].body.orientation =
-      mat3(glm::rotate(glm::mat4(1.0f), (float)TWO_PI / 4.0f, vec3(1.0f)));
+  if (m->recording) {
+    input_log_push(m->recording, m->tick, INPUT_MOUSEDOWN);
+  }
+  body_handle fruit =
+      add_fruit(m, vec3(0.0f, 0.0f, (float)BOX_HEIGHT), FRUIT_MELON);
+  store_orientation(
+      &m->bodies, body_store_lookup(&m->bodies, fruit),
+      glm::angleAxis((float)TWO_PI / 4.0f, glm::normalize(vec3(1.0f))));
+}
+void melon_mouseup(melon_state *m) {
+  if (m->recording) {
+    input_log_push(m->recording, m->tick, INPUT_MOUSEUP);
+  }
+}
+
+void melon_start_recording(melon_state *m, input_log *log) {
+  ASSERT(m->tick == 0);
+  log->physics = m->physics;
+  m->recording = log;
+}
+
+// Fills in where the game ended up, for replays to check against
+void melon_stop_recording(melon_state *m) {
+  m->recording->num_ticks = m->tick;
+  m->recording->checksum = body_store_checksum(&m->bodies);
+  m->recording = nullptr;
+}
+
+void melon_apply_input(melon_state *m, input_event_type type) {
+  switch (type) {
+  case INPUT_MOUSEMOTION: {
+    melon_mousemotion(m);
+  } break;
+  case INPUT_MOUSEDOWN: {
+    melon_mousedown(m);
+  } break;
+  case INPUT_MOUSEUP: {
+    melon_mouseup(m);
+  } break;
+  }
 }
-void melon_mouseup(melon_state *m) {}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "input_log.h"
 #include "physics.h"
 #include "types.h"
 
@@ -10,50 +11,168 @@
 #define BOX_DEPTH 2
 #define BOX_HEIGHT 2
 
+// The game always ticks at this rate, whatever the display does
+#define MELON_TICK_DT (1.0f / 60)
+// Slower frames than this are taken as this long, and at most this many
+// ticks are run for one. Past that the game slows down rather than falling
+// further behind trying to catch up.
+#define MELON_MAX_FRAME_TIME     0.25f
+#define MELON_MAX_TICKS_PER_FRAME 4
+
+// Merge candidates kept over a tick, each fruit is in at most one
+#define MELON_MAX_MERGES (MAX_FRUIT / 2)
+
+/*     ======  Fruit types ======
+ * Smallest to largest, two of a kind merge into the next one up. Everything
+ * derived from the radii and density is worked out at compile time, so the
+ * physics reads it straight out of the table. The renderer sends the table
+ * to the GPU once, the shaders don't know how many types there are.
+ */
+
+enum fruit_id : u32 {
+  FRUIT_CHERRY,
+  FRUIT_STRAWBERRY,
+  FRUIT_GRAPE,
+  FRUIT_DEKOPON,
+  FRUIT_PERSIMMON,
+  FRUIT_APPLE,
+  FRUIT_PEAR,
+  FRUIT_PEACH,
+  FRUIT_PINEAPPLE,
+  FRUIT_MELON,
+  FRUIT_WATERMELON,
+  FRUIT_TYPES
+};
+
 struct fruit_type {
   const char *label;
 
-  vec3 colour;
-  vec3 radii;
+  float colour[3];
+  float radii[3];
   float density;
 
-  // Derived from radii+density
+  // Derived from radii+density by fruit_type_derive
   float volume;
   float inv_mass;
-  mat3 inv_moi;
+  float inv_moi[3]; // Body space, it's diagonal
+  float radii2[3];
+  float bound; // Largest radius
 };
 
-fruit_type apple = {
-    .label = "apple",
-    .colour = {1.0f, 0.0f, 0.0f},
-    .radii = {0.1f, 0.1f, 0.1f},
-    .density = FRUIT_DENSITY
-};
-fruit_type melon = {
-    .label = "melon",
-    .colour = { 0.0f, 1.0f,  0.0f},
-    .radii = {0.14f, 0.2f, 0.14f},
-    .density = FRUIT_DENSITY
-};
+constexpr fruit_type fruit_type_derive(fruit_type f) {
+  float r1 = f.radii[0];
+  float r2 = f.radii[1];
+  float r3 = f.radii[2];
 
-fruit_type TABLE_fruit_type[2] = {apple, melon};
+  f.volume = 4.0f * PI * r1 * r2 * r3 / 3.0f;
+  float mass = f.density * f.volume;
+  f.inv_mass = 1.0f / mass;
+  f.inv_moi[0] = 5.0f / (mass * (r2 * r2 + r3 * r3));
+  f.inv_moi[1] = 5.0f / (mass * (r1 * r1 + r3 * r3));
+  f.inv_moi[2] = 5.0f / (mass * (r1 * r1 + r2 * r2));
+  for (int k = 0; k < 3; ++k) {
+    f.radii2[k] = f.radii[k] * f.radii[k];
+  }
+  f.bound = r1 > r2 ? (r1 > r3 ? r1 : r3) : (r2 > r3 ? r2 : r3);
+  return f;
+}
+
+constexpr fruit_type TABLE_fruit_type[FRUIT_TYPES] = {
+    fruit_type_derive({.label = "cherry",
+                       .colour = {0.8f, 0.0f, 0.1f},
+                       .radii = {0.04f, 0.04f, 0.04f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "strawberry",
+                       .colour = {1.0f, 0.3f, 0.3f},
+                       .radii = {0.05f, 0.055f, 0.05f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "grape",
+                       .colour = {0.5f, 0.2f, 0.8f},
+                       .radii = {0.06f, 0.06f, 0.06f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "dekopon",
+                       .colour = {1.0f, 0.6f, 0.0f},
+                       .radii = {0.07f, 0.07f, 0.07f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "persimmon",
+                       .colour = {1.0f, 0.4f, 0.0f},
+                       .radii = {0.085f, 0.075f, 0.085f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "apple",
+                       .colour = {1.0f, 0.0f, 0.0f},
+                       .radii = {0.1f, 0.1f, 0.1f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "pear",
+                       .colour = {0.8f, 0.9f, 0.3f},
+                       .radii = {0.11f, 0.13f, 0.11f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "peach",
+                       .colour = {1.0f, 0.7f, 0.6f},
+                       .radii = {0.125f, 0.125f, 0.125f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "pineapple",
+                       .colour = {0.9f, 0.8f, 0.2f},
+                       .radii = {0.13f, 0.18f, 0.13f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "melon",
+                       .colour = {0.0f, 1.0f, 0.0f},
+                       .radii = {0.14f, 0.2f, 0.14f},
+                       .density = FRUIT_DENSITY}),
+    fruit_type_derive({.label = "watermelon",
+                       .colour = {0.1f, 0.5f, 0.1f},
+                       .radii = {0.22f, 0.26f, 0.22f},
+                       .density = FRUIT_DENSITY}),
+};
 
 
 struct renderer_input {
   fruit_body *fruit;
+  bool *moved; // Whether each fruit was awake at any point this tick
 
   iZ num_fruit;
-  bool needs_reupload;
+  iZ num_awake;
+  int substeps; // What the last tick took
 };
 
 struct melon_state {
-  array<fruit_body> fruit;
-  array<body_dynamics> fruit_dynamics;
+  body_store bodies;
+
+  array<cached_contact> contacts;
+  physics_params physics;
+  job_pool *jobs;
+
+  u64 tick;              // Ticks since melon_init
+  input_log *recording; // Where input goes as it's applied, if anywhere
+
+  // The last tick, for picking the next one's substeps
+  int substeps;
+  physics_step_stats stats;
+  // Slots the last tick's merges left holding a different fruit than before
+  array<u32> replaced;
+
+  // Real time not yet ticked, for melon_advance
+  float accumulator;
+  // The fruit as of the last two ticks, which frames are drawn between. The
+  // moved flags are for the last tick, num_fruit as of it.
+  fruit_body *prev_fruit;
+  fruit_body *curr_fruit;
+  bool *curr_moved;
+  iZ curr_num_fruit;
+  iZ curr_num_awake;
 };
 
-void melon_init(melon_state *, arena *);
+void melon_init(melon_state *, arena *, physics_solver);
+// One tick of MELON_TICK_DT, ri gets the fruit as it ends
 void melon_tick(melon_state *, renderer_input *, arena *);
+// Runs however many ticks fit in the real time since the last call, then
+// gives ri the fruit interpolated between the last two of them
+void melon_advance(melon_state *, float seconds, renderer_input *, arena *);
 
 void melon_mousemotion(melon_state *);
 void melon_mousedown(melon_state *);
 void melon_mouseup(melon_state *);
+
+// Records all input from now on, has to start straight after melon_init
+void melon_start_recording(melon_state *, input_log *);
+void melon_stop_recording(melon_state *);
+void melon_apply_input(melon_state *, input_event_type);
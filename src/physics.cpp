@@ -1,11 +1,464 @@
 #include "physics.h"
+#include "trace.h"
 #include "melongame.h"
 
-void renormalise(mat3 &M); // Re-normalizes nearly orthonormal matrix
+/*     ======  Body store ====== */
+
+float *push_lane_array(arena *mem, iZ cap) {
+  float *p = (float *)arena_push_bytes(mem, cap * (iZ)sizeof(float),
+                                       SIMD_ALIGN);
+  memset(p, 0, (uZ)cap * sizeof(float));
+  return p;
+}
+
+template <class L> void world_matrices_lanes(body_store *s, iZ i);
+
+body_store new_body_store(arena *mem, iZ cap) {
+  cap = (cap + SIMD_MAX_WIDTH - 1) / SIMD_MAX_WIDTH * SIMD_MAX_WIDTH;
+
+  body_store s;
+  s.px = push_lane_array(mem, cap);
+  s.py = push_lane_array(mem, cap);
+  s.pz = push_lane_array(mem, cap);
+  s.qx = push_lane_array(mem, cap);
+  s.qy = push_lane_array(mem, cap);
+  s.qz = push_lane_array(mem, cap);
+  s.qw = push_lane_array(mem, cap);
+  s.vx = push_lane_array(mem, cap);
+  s.vy = push_lane_array(mem, cap);
+  s.vz = push_lane_array(mem, cap);
+  s.wx = push_lane_array(mem, cap);
+  s.wy = push_lane_array(mem, cap);
+  s.wz = push_lane_array(mem, cap);
+  s.inv_mass = push_lane_array(mem, cap);
+  s.id = (u32 *)push_lane_array(mem, cap);
+  for (int k = 0; k < 6; ++k) {
+    s.shape[k] = push_lane_array(mem, cap);
+    s.inv_moi[k] = push_lane_array(mem, cap);
+  }
+  for (int k = 0; k < 3; ++k) {
+    s.radii2[k] = push_lane_array(mem, cap);
+    s.inv_moi_local[k] = push_lane_array(mem, cap);
+  }
+  s.bound = push_lane_array(mem, cap);
+  s.awake = push_lane_array(mem, cap);
+  s.sleep_time = push_lane_array(mem, cap);
+  s.rest_px = push_lane_array(mem, cap);
+  s.rest_py = push_lane_array(mem, cap);
+  s.rest_pz = push_lane_array(mem, cap);
+  s.rest_qx = push_lane_array(mem, cap);
+  s.rest_qy = push_lane_array(mem, cap);
+  s.rest_qz = push_lane_array(mem, cap);
+  s.rest_qw = push_lane_array(mem, cap);
+  s.sleep_island = (u32 *)push_lane_array(mem, cap);
+  s.num = 0;
+  s.cap = cap;
+
+  ASSERT(cap <= BODY_HANDLE_INDEX_MASK);
+  s.handle = (u32 *)push_lane_array(mem, cap);
+  s.handle_body = arena_push<u32>(mem, cap);
+  s.handle_generation = arena_push<u32>(mem, cap);
+  for (iZ i = 0; i < cap; ++i) {
+    s.handle_body[i] = i + 1 < cap ? (u32)(i + 1) : BODY_HANDLE_NONE;
+    // Starts at 1 so a zeroed handle never resolves
+    s.handle_generation[i] = 1;
+  }
+  s.handle_free = 0;
+  return s;
+}
+
+// Gives the body in slot i a table entry of its own
+body_handle new_body_handle(body_store *s, iZ i) {
+  u32 entry = s->handle_free;
+  ASSERT(entry != BODY_HANDLE_NONE);
+  s->handle_free = s->handle_body[entry];
+  s->handle_body[entry] = (u32)i;
+  s->handle[i] = entry;
+  return body_store_handle(s, i);
+}
+
+void free_body_handle(body_store *s, iZ i) {
+  u32 entry = s->handle[i];
+  s->handle_generation[entry]++;
+  s->handle_body[entry] = s->handle_free;
+  s->handle_free = entry;
+}
+
+body_handle handle_of_entry(const body_store *s, u32 entry) {
+  return {.bits = s->handle_generation[entry] << BODY_HANDLE_INDEX_BITS |
+                  entry};
+}
+
+body_handle body_store_handle(const body_store *s, iZ i) {
+  return handle_of_entry(s, s->handle[i]);
+}
+
+iZ body_store_lookup(const body_store *s, body_handle h) {
+  u32 entry = h.bits & BODY_HANDLE_INDEX_MASK;
+  if (entry >= (u32)s->cap || handle_of_entry(s, entry).bits != h.bits) {
+    return -1;
+  }
+  return s->handle_body[entry];
+}
+
+// Everything but the handle, for a new body at rest
+void fill_body(body_store *s, iZ i, vec3 position, quat orientation,
+               u32 id) {
+  const fruit_type &type = TABLE_fruit_type[id];
+  s->px[i] = position.x;
+  s->py[i] = position.y;
+  s->pz[i] = position.z;
+  s->vx[i] = s->vy[i] = s->vz[i] = 0.0f;
+  s->wx[i] = s->wy[i] = s->wz[i] = 0.0f;
+  s->inv_mass[i] = type.inv_mass;
+  s->id[i] = id;
+  for (int k = 0; k < 3; ++k) {
+    s->radii2[k][i] = type.radii2[k];
+    s->inv_moi_local[k][i] = type.inv_moi[k];
+  }
+  s->bound[i] = type.bound;
+  store_orientation(s, i, orientation);
+  s->awake[i] = 1.0f;
+  s->sleep_time[i] = 0.0f;
+  s->sleep_island[i] = 0;
+}
+
+body_handle body_store_push(body_store *s, vec3 position, quat orientation,
+                            u32 id) {
+  ASSERT(s->num < s->cap);
+  iZ i = s->num++;
+  fill_body(s, i, position, orientation, id);
+  return new_body_handle(s, i);
+}
+
+body_handle body_store_set(body_store *s, iZ i, vec3 position,
+                           quat orientation, u32 id) {
+  ASSERT(i < s->num);
+  fill_body(s, i, position, orientation, id);
+  free_body_handle(s, i);
+  return new_body_handle(s, i);
+}
+
+#define BODY_STORE_ARRAYS 45
+
+// Every per body array in the store, all of them 4 bytes a body
+int body_store_arrays(body_store *s, void **arrays) {
+  int n = 0;
+  float *floats[] = {s->px, s->py, s->pz, s->qx, s->qy,
+                     s->qz, s->qw, s->vx, s->vy, s->vz,
+                     s->wx, s->wy, s->wz, s->inv_mass, s->bound,
+                     s->awake, s->sleep_time, s->rest_px, s->rest_py,
+                     s->rest_pz, s->rest_qx, s->rest_qy, s->rest_qz,
+                     s->rest_qw};
+  for (float *a : floats) {
+    arrays[n++] = a;
+  }
+  for (int k = 0; k < 6; ++k) {
+    arrays[n++] = s->shape[k];
+    arrays[n++] = s->inv_moi[k];
+  }
+  for (int k = 0; k < 3; ++k) {
+    arrays[n++] = s->radii2[k];
+    arrays[n++] = s->inv_moi_local[k];
+  }
+  arrays[n++] = s->id;
+  arrays[n++] = s->sleep_island;
+  arrays[n++] = s->handle;
+  return n;
+}
+
+void body_store_remove(body_store *s, const u32 *removed, iZ num_removed,
+                       u32 *remap) {
+  void *arrays[BODY_STORE_ARRAYS];
+  int num_arrays = body_store_arrays(s, arrays);
+  ASSERT(num_arrays == BODY_STORE_ARRAYS);
+  (void)num_arrays;
+
+  iZ old_num = s->num;
+  s->num -= num_removed;
+  for (iZ i = 0; i < old_num; ++i) {
+    remap[i] = (u32)i;
+  }
+  for (iZ r = 0; r < num_removed; ++r) {
+    remap[removed[r]] = BODY_REMOVED;
+    free_body_handle(s, removed[r]);
+  }
+
+  // Gaps under the new end are filled in order by what's kept past it
+  iZ from = s->num;
+  for (iZ r = 0; r < num_removed && removed[r] < (u32)s->num; ++r) {
+    while (remap[from] == BODY_REMOVED) {
+      ++from;
+    }
+    for (void *a : arrays) {
+      u8 *bytes = (u8 *)a;
+      memcpy(bytes + 4 * removed[r], bytes + 4 * from, 4);
+    }
+    s->handle_body[s->handle[removed[r]]] = removed[r];
+    remap[from++] = removed[r];
+  }
+  // Padding lanes get stepped too, so they're left as an empty store has them
+  for (void *a : arrays) {
+    u8 *bytes = (u8 *)a;
+    memset(bytes + 4 * s->num, 0, 4 * (uZ)num_removed);
+  }
+
+  // Sleeping islands are named after one of their bodies
+  for (iZ i = 0; i < s->num; ++i) {
+    if (s->awake[i] == 0.0f) {
+      u32 island = remap[s->sleep_island[i]];
+      ASSERT(island != BODY_REMOVED);
+      s->sleep_island[i] = island;
+    }
+  }
+}
+
+fruit_body load_body(const body_store *s, iZ i) {
+  fruit_body f;
+  f.body.position = vec3(s->px[i], s->py[i], s->pz[i]);
+  f.body.orientation = quat(s->qw[i], s->qx[i], s->qy[i], s->qz[i]);
+  f.id = s->id[i];
+  return f;
+}
+
+void store_orientation(body_store *s, iZ i, quat orientation) {
+  s->qx[i] = orientation.x;
+  s->qy[i] = orientation.y;
+  s->qz[i] = orientation.z;
+  s->qw[i] = orientation.w;
+  world_matrices_lanes<lanes_scalar>(s, i);
+}
+
+vec3 load_linear_velocity(const body_store *s, iZ i) {
+  return vec3(s->vx[i], s->vy[i], s->vz[i]);
+}
+
+// Symmetric matrices are stored as xx yy zz xy xz yz
+const int SYM_ROW[6] = {0, 1, 2, 0, 0, 1};
+const int SYM_COL[6] = {0, 1, 2, 1, 2, 2};
+
+mat3 load_symmetric(float *const *m, iZ i) {
+  mat3 result;
+  for (int k = 0; k < 6; ++k) {
+    result[SYM_COL[k]][SYM_ROW[k]] = result[SYM_ROW[k]][SYM_COL[k]] = m[k][i];
+  }
+  return result;
+}
+
+mat3 load_inv_moi(const body_store *s, iZ i) {
+  return load_symmetric(s->inv_moi, i);
+}
+
+collision_body load_collision_body(const body_store *s, iZ i) {
+  collision_body c;
+  c.position = vec3(s->px[i], s->py[i], s->pz[i]);
+  c.shape = load_symmetric(s->shape, i);
+  c.bound = s->bound[i];
+  return c;
+}
+
+collision_body make_collision_body(const fruit_body *f) {
+  const fruit_type &type = TABLE_fruit_type[f->id];
+  vec3 A = vec3(type.radii[0], type.radii[1], type.radii[2]);
+  mat3 R = glm::mat3_cast(f->body.orientation);
+  mat3 RA = mat3(R[0] * A.x, R[1] * A.y, R[2] * A.z);
+
+  collision_body c;
+  c.position = f->body.position;
+  c.shape = RA * glm::transpose(RA);
+  c.bound = type.bound;
+  return c;
+}
+
+// Wakes the body and everything that fell asleep with it
+void wake_body(body_store *s, iZ i) {
+  if (s->awake[i] != 0.0f) {
+    return;
+  }
+  u32 island = s->sleep_island[i];
+  for (iZ j = 0; j < s->num; ++j) {
+    if (s->awake[j] == 0.0f && s->sleep_island[j] == island) {
+      s->awake[j] = 1.0f;
+      s->sleep_time[j] = 0.0f;
+    }
+  }
+}
+
+iZ count_awake(const body_store *s) {
+  iZ n = 0;
+  for (iZ i = 0; i < s->num; ++i) {
+    n += s->awake[i] != 0.0f;
+  }
+  return n;
+}
+
+// FNV-1a over the bits of each array in turn
+u64 body_store_checksum(const body_store *s) {
+  u64 hash = 14695981039346656037ull;
+  const float *arrays[] = {s->px, s->py, s->pz, s->qx, s->qy, s->qz, s->qw};
+  for (const float *a : arrays) {
+    for (iZ i = 0; i < s->num; ++i) {
+      u32 bits;
+      memcpy(&bits, &a[i], sizeof(bits));
+      hash = (hash ^ bits) * 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+/*     ======  Integration kernels ======
+ * Templated over the lanes in simd.h, and stepped over whole vectors, since
+ * the store is padded. physics_step runs the lanes_simd versions, the
+ * lanes_scalar ones are the reference they have to match exactly.
+ *
+ * Sleeping bodies have no velocity and are masked out of gravity and
+ * normalisation, so they come out bit for bit unchanged.
+ */
+
+// World space shape and inverse inertia of the bodies at i, R * diag * R^T
+// for their body space diagonals
+template <class L>
+void world_matrices_lanes(body_store *s, iZ i) {
+  typedef typename L::f32 f32;
+  f32 x = L::load(s->qx + i);
+  f32 y = L::load(s->qy + i);
+  f32 z = L::load(s->qz + i);
+  f32 w = L::load(s->qw + i);
+
+  // R[3 * c + r] is column c, row r, of the quaternion's rotation
+  f32 one = L::set1(1.0f);
+  f32 two = L::set1(2.0f);
+  f32 xx = L::mul(x, x), yy = L::mul(y, y), zz = L::mul(z, z);
+  f32 xy = L::mul(x, y), xz = L::mul(x, z), yz = L::mul(y, z);
+  f32 wx = L::mul(w, x), wy = L::mul(w, y), wz = L::mul(w, z);
+  f32 R[9];
+  R[0] = L::sub(one, L::mul(two, L::add(yy, zz)));
+  R[1] = L::mul(two, L::add(xy, wz));
+  R[2] = L::mul(two, L::sub(xz, wy));
+  R[3] = L::mul(two, L::sub(xy, wz));
+  R[4] = L::sub(one, L::mul(two, L::add(xx, zz)));
+  R[5] = L::mul(two, L::add(yz, wx));
+  R[6] = L::mul(two, L::add(xz, wy));
+  R[7] = L::mul(two, L::sub(yz, wx));
+  R[8] = L::sub(one, L::mul(two, L::add(xx, yy)));
+  f32 a2[3], m[3];
+  for (int k = 0; k < 3; ++k) {
+    a2[k] = L::load(s->radii2[k] + i);
+    m[k] = L::load(s->inv_moi_local[k] + i);
+  }
+
+  for (int e = 0; e < 6; ++e) {
+    int r = SYM_ROW[e];
+    int c = SYM_COL[e];
+    f32 p0 = L::mul(R[r], R[c]);
+    f32 p1 = L::mul(R[3 + r], R[3 + c]);
+    f32 p2 = L::mul(R[6 + r], R[6 + c]);
+    L::store(s->shape[e] + i,
+             L::add(L::add(L::mul(p0, a2[0]), L::mul(p1, a2[1])),
+                    L::mul(p2, a2[2])));
+    L::store(s->inv_moi[e] + i,
+             L::add(L::add(L::mul(p0, m[0]), L::mul(p1, m[1])),
+                    L::mul(p2, m[2])));
+  }
+}
+
+template <class L>
+void world_matrices_kernel(body_store *s) {
+  for (iZ i = 0; i < s->num; i += L::width) {
+    world_matrices_lanes<L>(s, i);
+  }
+}
+
+// Gap from every body to every container plane,
+//   dot(p, n) - offset - h(-n)
+// where the support distance h(-n) = sqrt(n.M.n) for shape matrix M.
+// gaps[k] is a lane array for plane k.
+template <class L>
+void container_gaps_kernel(const body_store *s, const container_plane *planes,
+                           float **gaps) {
+  typedef typename L::f32 f32;
+  for (iZ i = 0; i < s->num; i += L::width) {
+    f32 p[3] = {L::load(s->px + i), L::load(s->py + i), L::load(s->pz + i)};
+    f32 M[6];
+    for (int e = 0; e < 6; ++e) {
+      M[e] = L::load(s->shape[e] + i);
+    }
+
+    for (int k = 0; k < CONTAINER_PLANES; ++k) {
+      vec3 n = planes[k].normal;
+      f32 pn = L::add(L::add(L::mul(p[0], L::set1(n.x)),
+                             L::mul(p[1], L::set1(n.y))),
+                      L::mul(p[2], L::set1(n.z)));
+      f32 nMn = L::set1(0.0f);
+      for (int e = 0; e < 6; ++e) {
+        float w = n[SYM_ROW[e]] * n[SYM_COL[e]] * (e < 3 ? 1.0f : 2.0f);
+        nMn = L::add(nMn, L::mul(M[e], L::set1(w)));
+      }
+      f32 gap = L::sub(L::sub(pn, L::set1(planes[k].offset)), L::sqrt(nMn));
+      L::store(gaps[k] + i, gap);
+    }
+  }
+}
+
+template <class L>
+void integrate_velocities_kernel(body_store *s, float dt, float gravity) {
+  typedef typename L::f32 f32;
+  f32 g_dt = L::set1(dt * gravity);
+  for (iZ i = 0; i < s->num; i += L::width) {
+    // Only awake bodies with mass fall
+    f32 g = L::and_nonzero(L::load(s->inv_mass + i), g_dt);
+    f32 vz = L::load(s->vz + i);
+    vz = L::add(vz, L::and_nonzero(L::load(s->awake + i), g));
+    L::store(s->vz + i, vz);
+  }
+}
+
+template <class L>
+void integrate_positions_kernel(body_store *s, float dt) {
+  typedef typename L::f32 f32;
+  f32 h = L::set1(dt);
+  f32 half_h = L::set1(0.5f * dt);
+  f32 one = L::set1(1.0f);
+  for (iZ i = 0; i < s->num; i += L::width) {
+    f32 vx = L::load(s->vx + i);
+    f32 vy = L::load(s->vy + i);
+    f32 vz = L::load(s->vz + i);
+    L::store(s->px + i, L::add(L::load(s->px + i), L::mul(h, vx)));
+    L::store(s->py + i, L::add(L::load(s->py + i), L::mul(h, vy)));
+    L::store(s->pz + i, L::add(L::load(s->pz + i), L::mul(h, vz)));
+
+    // dq/dt = w * q / 2, for w as a quaternion with no real part, then
+    // back to unit length. Sleeping bodies have no w, but normalising could
+    // still move them, so they keep what they had.
+    f32 wx = L::mul(half_h, L::load(s->wx + i));
+    f32 wy = L::mul(half_h, L::load(s->wy + i));
+    f32 wz = L::mul(half_h, L::load(s->wz + i));
+    f32 qx = L::load(s->qx + i);
+    f32 qy = L::load(s->qy + i);
+    f32 qz = L::load(s->qz + i);
+    f32 qw = L::load(s->qw + i);
+    f32 nx = L::add(qx, L::add(L::mul(wx, qw),
+                               L::sub(L::mul(wy, qz), L::mul(wz, qy))));
+    f32 ny = L::add(qy, L::add(L::mul(wy, qw),
+                               L::sub(L::mul(wz, qx), L::mul(wx, qz))));
+    f32 nz = L::add(qz, L::add(L::mul(wz, qw),
+                               L::sub(L::mul(wx, qy), L::mul(wy, qx))));
+    f32 nw = L::sub(qw, L::add(L::add(L::mul(wx, qx), L::mul(wy, qy)),
+                               L::mul(wz, qz)));
+    f32 len2 = L::add(L::add(L::mul(nx, nx), L::mul(ny, ny)),
+                      L::add(L::mul(nz, nz), L::mul(nw, nw)));
+    f32 k = L::div(one, L::sqrt(len2));
+    f32 awake = L::load(s->awake + i);
+    L::store(s->qx + i, L::select_nonzero(awake, L::mul(nx, k), qx));
+    L::store(s->qy + i, L::select_nonzero(awake, L::mul(ny, k), qy));
+    L::store(s->qz + i, L::select_nonzero(awake, L::mul(nz, k), qz));
+    L::store(s->qw + i, L::select_nonzero(awake, L::mul(nw, k), qw));
+  }
+}
 
 // finds the point on ellip furthest in the direction dir
 // returns the vector in world space, relative to the ellip origin
-vec3 support_ellip(fruit_body *ellip, vec3 dir) {
+vec3 support_ellip(collision_body *ellip, vec3 dir) {
   /*
    * Ellipsoid = R * A * Unit Sphere
    *   where R = orientation matrix of body
@@ -13,14 +466,16 @@ vec3 support_ellip(fruit_body *ellip, vec3 dir) {
    *     and A = (0, r2,  0) contains it's radii
    *             (0,  0, r3)
    *
-   * Furthest point on ellip in direction n is
-   *   p_local = A * R^T * n
+   * Maximising n.(R * A * u) over unit u gives u = A * R^T * n / |A * R^T * n|
+   * so the furthest point on ellip in direction n is
+   *   p = R * A * A * R^T * n / |A * R^T * n|
    *   where R^T is the transpose (inverse rotation) of R
+   *
+   * With the shape matrix M = R * A * A * R^T that's M * n / sqrt(n.M.n)
    */
-  vec3 A = TABLE_fruit_type[ellip->id].radii;
-  mat3 R = ellip->body.orientation;
-  mat3 RT = glm::transpose(R);
-  return R * (A * (RT * dir));
+  vec3 Mn = ellip->shape * dir;
+  float h2 = glm::dot(dir, Mn);
+  return (h2 > 0.0f) ? Mn / sqrtf(h2) : vec3(0.0f);
 }
 
 struct collision_manifold {
@@ -31,153 +486,1506 @@ struct collision_manifold {
   vec3 n_ba;
 };
 
-collision_manifold collision_ellip_plane(fruit_body *ellip, vec3 plane_origin,
-                                         vec3 plane_normal) {
-  vec3 r_pa = support_ellip(ellip, -plane_normal);
-  vec3 r_pb = r_pa + ellip->body.position - plane_origin;
-  float gap = glm::dot(r_pb, plane_normal);
+collision_manifold collision_ellip_plane(collision_body *ellip,
+                                         const container_plane *plane) {
+  vec3 n = plane->normal;
+  vec3 r_pa = support_ellip(ellip, -n);
+  vec3 r_pb = r_pa + ellip->position - plane->offset * n;
+  float gap = glm::dot(r_pb, n);
 
   collision_manifold result;
   result.gap = gap;
   result.r_pa = r_pa;
   result.r_pb = r_pb;
-  result.n_ba = -plane_normal;
+  result.n_ba = -n;
 
   return result;
 }
 
-#if 0
-// TODO - Think about consistent labelling, required for warm starting
-collision_manifold collision_ellip_ellip(fruit_body *ellip_a,
-                                         fruit_body *ellip_b) {
-  vec3 n_ba
-  vec3 r_pa = support_ellip(ellip_a, 
+/*     ======  Ellipsoid pairs ======
+ * Everything works on the Minkowski difference D = B - A, whose support is
+ *   s_D(d) = (p_b + s_b(d)) - (p_a + s_a(-d))
+ *
+ * For a unit axis n (pointing from a to b) the gap along it is
+ *   gap(n) = n.(p_b - p_a) - h_a(n) - h_b(-n)
+ * and the signed distance between a and b is the max of gap(n) over all n,
+ * both when separated and when overlapping. collision_ellip_ellip returns the
+ * manifold at that axis.
+ *
+ * If the axis from the last step is known we just polish it with Newton steps
+ * on gap(n), which for resting pairs converges in one or two. Otherwise (or if
+ * that doesn't converge) GJK finds the closest point of D to the origin, or
+ * EPA the closest face of D when the origin is inside it, and that axis gets
+ * polished instead.
+ */
+
+#define NARROWPHASE_MAX_ITERS 8
+#define NARROWPHASE_ANGLE_TOLERANCE 1e-4f
+
+#define GJK_MAX_ITERS 32
+#define GJK_TOLERANCE 1e-3f
+#define EPA_MAX_ITERS 32
+#define EPA_MAX_VERTS (4 + EPA_MAX_ITERS)
+#define EPA_MAX_FACES (2 * EPA_MAX_VERTS)
+#define EPA_TOLERANCE 1e-3f
+
+collision_manifold collision_from_axis(collision_body *ellip_a,
+                                       collision_body *ellip_b, vec3 n_ba) {
+  vec3 r_pa = support_ellip(ellip_a, n_ba);
+  vec3 r_pb = support_ellip(ellip_b, -n_ba);
+  vec3 w = (ellip_b->position + r_pb) - (ellip_a->position + r_pa);
+
+  collision_manifold result;
+  result.gap = glm::dot(w, n_ba);
+  result.r_pa = r_pa;
+  result.r_pb = r_pb;
+  result.n_ba = n_ba;
+
+  return result;
 }
-#endif
 
-void physics_step(fruit_body *fruit, body_dynamics *dynamics, iZ num_bodies,
-                  float dt) {
-  float gravity = -10.0f;
+// Newton step on gap(n) along its gradient, the tangential part of the vector
+// between the two support points. The curvature along that direction is
+//   gap + rho_a + rho_b
+// where rho is each ellipsoid's radius of curvature, (t.M.t - (t.s)^2) / h for
+// shape matrix M, support point s and support distance h.
+// Returns the step angle, which is ~0 once n is converged.
+float refine_axis(collision_body *ellip_a, collision_body *ellip_b,
+                  const collision_manifold &m, vec3 *n_ba) {
+  vec3 n = m.n_ba;
+  vec3 w = (ellip_b->position + m.r_pb) -
+           (ellip_a->position + m.r_pa);
+  vec3 w_perp = w - m.gap * n;
+
+  float g = glm::length(w_perp);
+  if (g < 1e-9f) {
+    return 0.0f;
+  }
+  vec3 t = w_perp / g;
+
+  float h_a = glm::dot(m.r_pa, n);
+  float h_b = -glm::dot(m.r_pb, n);
+  float ts_a = glm::dot(t, m.r_pa);
+  float ts_b = glm::dot(t, m.r_pb);
+  float rho_a = (glm::dot(t, ellip_a->shape * t) - ts_a * ts_a) / h_a;
+  float rho_b = (glm::dot(t, ellip_b->shape * t) - ts_b * ts_b) / h_b;
+
+  float curvature = m.gap + rho_a + rho_b;
+  if (curvature <= 1e-6f) {
+    curvature = h_a + h_b;
+  }
+
+  *n_ba = glm::normalize(n + w_perp / curvature);
+  return g / curvature;
+}
+
+vec3 support_minkowski(collision_body *ellip_a, collision_body *ellip_b,
+                       vec3 d) {
+  return (ellip_b->position + support_ellip(ellip_b, d)) -
+         (ellip_a->position + support_ellip(ellip_a, -d));
+}
+
+struct gjk_simplex {
+  vec3 w[4];
+  int num;
+};
+
+// Replaces s by the smallest sub-simplex containing its closest point to the
+// origin, and returns that point.
+// Tries every face, a face's projection of the origin is a candidate if it
+// lands strictly inside the face. Every candidate is a point of the simplex,
+// so the nearest one is the closest point.
+vec3 gjk_closest(gjk_simplex *s) {
+  vec3 best_v = s->w[0];
+  int best_mask = 1;
+  float best_d2 = glm::dot(best_v, best_v);
+
+  for (int mask = 2; mask < (1 << s->num); ++mask) {
+    vec3 p[4];
+    int k = 0;
+    for (int i = 0; i < s->num; ++i) {
+      if (mask & (1 << i)) {
+        p[k++] = s->w[i];
+      }
+    }
+
+    vec3 v;
+    float l[4];
+    if (k == 1) {
+      v = p[0];
+    } else if (k == 2) {
+      vec3 e = p[1] - p[0];
+      float ee = glm::dot(e, e);
+      if (ee < 1e-12f) {
+        continue;
+      }
+      l[1] = -glm::dot(p[0], e) / ee;
+      l[0] = 1.0f - l[1];
+      if (l[0] <= 0.0f || l[1] <= 0.0f) {
+        continue;
+      }
+      v = p[0] + l[1] * e;
+    } else if (k == 3) {
+      vec3 e1 = p[1] - p[0];
+      vec3 e2 = p[2] - p[0];
+      float a11 = glm::dot(e1, e1), a12 = glm::dot(e1, e2);
+      float a22 = glm::dot(e2, e2);
+      float b1 = -glm::dot(p[0], e1), b2 = -glm::dot(p[0], e2);
+      float det = a11 * a22 - a12 * a12;
+      if (det < 1e-12f * a11 * a22) {
+        continue;
+      }
+      l[1] = (b1 * a22 - b2 * a12) / det;
+      l[2] = (b2 * a11 - b1 * a12) / det;
+      l[0] = 1.0f - l[1] - l[2];
+      if (l[0] <= 0.0f || l[1] <= 0.0f || l[2] <= 0.0f) {
+        continue;
+      }
+      v = p[0] + l[1] * e1 + l[2] * e2;
+    } else {
+      vec3 e1 = p[1] - p[0];
+      vec3 e2 = p[2] - p[0];
+      vec3 e3 = p[3] - p[0];
+      float det = glm::dot(e1, glm::cross(e2, e3));
+      if (fabsf(det) < 1e-12f) {
+        continue;
+      }
+      // Cramer's rule for e * l = -p0
+      vec3 o = -p[0];
+      l[1] = glm::dot(o, glm::cross(e2, e3)) / det;
+      l[2] = glm::dot(e1, glm::cross(o, e3)) / det;
+      l[3] = glm::dot(e1, glm::cross(e2, o)) / det;
+      l[0] = 1.0f - l[1] - l[2] - l[3];
+      if (l[0] <= 0.0f || l[1] <= 0.0f || l[2] <= 0.0f || l[3] <= 0.0f) {
+        continue;
+      }
+      v = vec3(0.0f);
+    }
+
+    float d2 = glm::dot(v, v);
+    if (d2 < best_d2) {
+      best_d2 = d2;
+      best_v = v;
+      best_mask = mask;
+    }
+  }
+
+  int k = 0;
+  for (int i = 0; i < s->num; ++i) {
+    if (best_mask & (1 << i)) {
+      s->w[k++] = s->w[i];
+    }
+  }
+  s->num = k;
+
+  return best_v;
+}
+
+// Closest point of D to the origin, starting the search along -dir.
+// Returns false if the origin is inside D, with s left as the simplex that
+// contains it.
+bool gjk_distance(collision_body *ellip_a, collision_body *ellip_b, vec3 dir,
+                  vec3 *v_out, gjk_simplex *s) {
+  s->w[0] = support_minkowski(ellip_a, ellip_b, -dir);
+  s->num = 1;
+  vec3 v = s->w[0];
+
+  for (int iter = 0; iter < GJK_MAX_ITERS; ++iter) {
+    float vv = glm::dot(v, v);
+    if (vv < 1e-12f) {
+      return false;
+    }
+
+    vec3 w = support_minkowski(ellip_a, ellip_b, -v);
+    if (vv - glm::dot(v, w) <= GJK_TOLERANCE * sqrtf(vv)) {
+      break;
+    }
+
+    s->w[s->num++] = w;
+    v = gjk_closest(s);
+    if (s->num == 4) {
+      return false;
+    }
+  }
+
+  *v_out = v;
+  return true;
+}
+
+struct epa_face {
+  int i[3];
+  vec3 n;
+  float d;
+};
+
+bool epa_make_face(vec3 *verts, int i0, int i1, int i2, epa_face *f) {
+  vec3 n = glm::cross(verts[i1] - verts[i0], verts[i2] - verts[i0]);
+  float len = glm::length(n);
+  if (len < 1e-12f) {
+    return false;
+  }
+  f->i[0] = i0;
+  f->i[1] = i1;
+  f->i[2] = i2;
+  f->n = n / len;
+  f->d = glm::dot(f->n, verts[i0]);
+  return true;
+}
+
+// Outward normal of the face of D nearest the origin, for a tetrahedron s
+// that contains the origin
+vec3 epa_normal(collision_body *ellip_a, collision_body *ellip_b,
+                gjk_simplex *s) {
+  ASSERT(s->num == 4);
+  vec3 verts[EPA_MAX_VERTS];
+  epa_face faces[EPA_MAX_FACES];
+  int num_verts = 4;
+  int num_faces = 0;
+  for (int i = 0; i < 4; ++i) {
+    verts[i] = s->w[i];
+  }
+
+  // Wind the tetrahedron so that every normal faces away from the
+  // opposite vertex
+  if (glm::dot(verts[3] - verts[0],
+               glm::cross(verts[1] - verts[0], verts[2] - verts[0])) > 0.0f) {
+    vec3 tmp = verts[1];
+    verts[1] = verts[2];
+    verts[2] = tmp;
+  }
+  int tet[4][3] = {{0, 1, 2}, {0, 3, 1}, {0, 2, 3}, {1, 3, 2}};
+  for (auto &t : tet) {
+    if (epa_make_face(verts, t[0], t[1], t[2], &faces[num_faces])) {
+      num_faces++;
+    }
+  }
+
+  vec3 best_n = faces[0].n;
+  for (int iter = 0; iter < EPA_MAX_ITERS; ++iter) {
+    int closest = 0;
+    for (int f = 1; f < num_faces; ++f) {
+      if (faces[f].d < faces[closest].d) {
+        closest = f;
+      }
+    }
+    epa_face face = faces[closest];
+    best_n = face.n;
+
+    vec3 w = support_minkowski(ellip_a, ellip_b, face.n);
+    if (glm::dot(w, face.n) - face.d < EPA_TOLERANCE ||
+        num_verts == EPA_MAX_VERTS) {
+      break;
+    }
+    int iw = num_verts++;
+    verts[iw] = w;
+
+    // Remove every face w can see, keeping the edges of the hole
+    int edges[3 * EPA_MAX_FACES][2];
+    int num_edges = 0;
+    for (int f = 0; f < num_faces;) {
+      if (glm::dot(faces[f].n, w - verts[faces[f].i[0]]) <= 0.0f) {
+        ++f;
+        continue;
+      }
+      for (int e = 0; e < 3; ++e) {
+        int a = faces[f].i[e];
+        int b = faces[f].i[(e + 1) % 3];
+        bool shared = false;
+        for (int k = 0; k < num_edges; ++k) {
+          if (edges[k][0] == b && edges[k][1] == a) {
+            edges[k][0] = edges[--num_edges][0];
+            edges[k][1] = edges[num_edges][1];
+            shared = true;
+            break;
+          }
+        }
+        if (!shared) {
+          edges[num_edges][0] = a;
+          edges[num_edges][1] = b;
+          num_edges++;
+        }
+      }
+      faces[f] = faces[--num_faces];
+    }
+
+    for (int e = 0; e < num_edges && num_faces < EPA_MAX_FACES; ++e) {
+      if (epa_make_face(verts, edges[e][0], edges[e][1], iw,
+                        &faces[num_faces])) {
+        num_faces++;
+      }
+    }
+    if (num_faces == 0) {
+      break;
+    }
+  }
+
+  return best_n;
+}
+
+// Full search for the separating axis, no previous axis needed
+vec3 collision_axis_gjk_epa(collision_body *ellip_a, collision_body *ellip_b) {
+  vec3 centres = ellip_b->position - ellip_a->position;
+  vec3 dir = (glm::dot(centres, centres) > 1e-12f) ? centres
+                                                    : vec3(0.0f, 0.0f, 1.0f);
+  vec3 v;
+  gjk_simplex s;
+  if (gjk_distance(ellip_a, ellip_b, dir, &v, &s)) {
+    return glm::normalize(v);
+  }
+  if (s.num == 4) {
+    return -epa_normal(ellip_a, ellip_b, &s);
+  }
+  // Origin is on the surface of D, so they're just touching, and the line
+  // between the centres is close enough for the Newton steps to take over
+  return glm::normalize(dir);
+}
+
+// Signed distance between two ellipsoids, *axis is the separating direction
+// from the last call for this pair, or zero if there isn't one. Updated to the
+// new axis on return.
+collision_manifold collision_ellip_ellip(collision_body *ellip_a,
+                                         collision_body *ellip_b, vec3 *axis) {
+  vec3 n = *axis;
+  bool warm = glm::dot(n, n) > 0.0f;
+  if (!warm) {
+    n = collision_axis_gjk_epa(ellip_a, ellip_b);
+  }
+
+  collision_manifold m = collision_from_axis(ellip_a, ellip_b, n);
+  int iter = 0;
+  while (refine_axis(ellip_a, ellip_b, m, &n) >= NARROWPHASE_ANGLE_TOLERANCE) {
+    if (++iter == NARROWPHASE_MAX_ITERS) {
+      if (!warm) {
+        break;
+      }
+      // Stale axis, start again from scratch
+      warm = false;
+      iter = 0;
+      n = collision_axis_gjk_epa(ellip_a, ellip_b);
+    }
+    m = collision_from_axis(ellip_a, ellip_b, n);
+  }
+
+  *axis = m.n_ba;
+  return m;
+}
+
+/*     ======  Broadphase ======
+ * Uniform grid over the box footprint, with cells at least as wide as the
+ * largest fruit's bounding sphere so any overlapping pair sits in the same or
+ * neighbouring cells. The grid extends upwards to cover fruit above the rim,
+ * anything outside is clamped into the border cells.
+ *
+ * Bodies are counting sorted into cells, then each body checks the 27 cells
+ * around it and keeps bounding sphere overlaps with a < b. The pairs come out
+ * sorted by (a, b), and are allocated from mem, everything else is scratch.
+ * Overlaps past BROADPHASE_MAX_PAIRS_PER_BODY a body on average are left out
+ * and counted in num_dropped.
+ */
+
+// Per axis, cell coordinates are packed into 10 bits. Fruit far enough above
+// the box to need more all go in the top layer.
+#define BROADPHASE_MAX_CELLS 1024
+
+array<body_pair> broadphase_pairs(collision_body *bodies, iZ num_bodies,
+                                  vec3 box, arena *mem, iZ *num_dropped) {
+  array<body_pair> pairs =
+      new_array<body_pair>(mem, num_bodies * BROADPHASE_MAX_PAIRS_PER_BODY);
+  if (num_dropped) {
+    *num_dropped = 0;
+  }
+  if (num_bodies < 2) {
+    return pairs;
+  }
+  arena scratch = *mem;
+
+  vec3 *pos = arena_push<vec3>(&scratch, num_bodies);
+  float *rad = arena_push<float>(&scratch, num_bodies);
+  float max_radius = 0.0f;
+  float top = box.z;
+  for (int i = 0; i < num_bodies; ++i) {
+    pos[i] = bodies[i].position;
+    rad[i] = bodies[i].bound;
+    max_radius = glm::max(max_radius, rad[i]);
+    top = glm::max(top, pos[i].z);
+  }
+
+  float cell_size = 2.0f * max_radius;
+  vec3 grid_min = vec3(-box.x / 2.0f, -box.y / 2.0f, 0.0f);
+  auto cells = [&](float length) {
+    return glm::clamp((int)ceilf(length / cell_size), 1, BROADPHASE_MAX_CELLS);
+  };
+  int nx = cells(box.x);
+  int ny = cells(box.y);
+  int nz = cells(top - grid_min.z);
+  int num_cells = nx * ny * nz;
+
+  // Cell coordinates of each body, packed as x | y << 10 | z << 20
+  u32 *coord = arena_push<u32>(&scratch, num_bodies);
+  u32 *cell_start = arena_push<u32>(&scratch, num_cells + 1);
+  memset(cell_start, 0, (uZ)(num_cells + 1) * sizeof(u32));
+  for (int i = 0; i < num_bodies; ++i) {
+    vec3 g = (pos[i] - grid_min) / cell_size;
+    int cx = glm::clamp((int)floorf(g.x), 0, nx - 1);
+    int cy = glm::clamp((int)floorf(g.y), 0, ny - 1);
+    int cz = glm::clamp((int)floorf(g.z), 0, nz - 1);
+    coord[i] = (u32)cx | (u32)cy << 10 | (u32)cz << 20;
+    cell_start[(cz * ny + cy) * nx + cx + 1]++;
+  }
+
+  for (int c = 0; c < num_cells; ++c) {
+    cell_start[c + 1] += cell_start[c];
+  }
+  u32 *cursor = arena_push<u32>(&scratch, num_cells);
+  memcpy(cursor, cell_start, (uZ)num_cells * sizeof(u32));
+  u32 *sorted = arena_push<u32>(&scratch, num_bodies);
+  for (int i = 0; i < num_bodies; ++i) {
+    int cx = (int)(coord[i] & 1023);
+    int cy = (int)(coord[i] >> 10 & 1023);
+    int cz = (int)(coord[i] >> 20);
+    sorted[cursor[(cz * ny + cy) * nx + cx]++] = (u32)i;
+  }
 
-  // Integrate velocities
+  iZ dropped = 0;
   for (int i = 0; i < num_bodies; ++i) {
-    const fruit_type &type = TABLE_fruit_type[fruit[i].id];
+    int cx = (int)(coord[i] & 1023);
+    int cy = (int)(coord[i] >> 10 & 1023);
+    int cz = (int)(coord[i] >> 20);
+    body_pair *run = pairs.tail;
+
+    for (int z = glm::max(cz - 1, 0); z <= glm::min(cz + 1, nz - 1); ++z) {
+      for (int y = glm::max(cy - 1, 0); y <= glm::min(cy + 1, ny - 1); ++y) {
+        for (int x = glm::max(cx - 1, 0); x <= glm::min(cx + 1, nx - 1); ++x) {
+          int c = (z * ny + y) * nx + x;
+          for (u32 k = cell_start[c]; k < cell_start[c + 1]; ++k) {
+            u32 j = sorted[k];
+            if (j <= (u32)i) {
+              continue;
+            }
+            vec3 d = pos[j] - pos[i];
+            float r = rad[i] + rad[j];
+            if (glm::dot(d, d) > r * r) {
+              continue;
+            }
+            if (pairs.isfull()) {
+              dropped++;
+              continue;
+            }
+            pairs.push({.a = (u32)i, .b = j});
+          }
+        }
+      }
+    }
+
+    // Only a handful per body, insertion sort is fine
+    for (body_pair *p = run + 1; p < pairs.tail; ++p) {
+      body_pair v = *p;
+      body_pair *q = p;
+      for (; q > run && q[-1].b > v.b; --q) {
+        q[0] = q[-1];
+      }
+      *q = v;
+    }
+  }
+
+  if (num_dropped) {
+    *num_dropped = dropped;
+  }
+  return pairs;
+}
+
+/*     ======  Continuous collision ======
+ * Conservative advancement, for bodies that move a good part of their own
+ * size in one step. Without it a fast body can end a step deep inside (or
+ * through) whatever it hit, and only the solver pushes it back out.
+ *
+ * Only translation is swept. A body turning in place stays inside its
+ * bounding sphere, so it can't pass through anything, and the overlap its
+ * turning makes is the solver's like any other. For two convex bodies
+ * moving in straight lines the distance between them is convex in time, so
+ * it never falls faster than it's falling now, d / rate for the rate along
+ * the axis between them. Stepping on by that until d is under PHYSICS_SLOP
+ * finds the time of impact from below. The fast body then only moves that
+ * far through the step, plus long enough at the same rate to overlap by
+ * another PHYSICS_SLOP, so the next step's narrowphase has the contact and
+ * the solver takes out the velocity. The velocity itself is left alone.
+ *
+ * The broadphase only has this step's bounds, so every body's swept
+ * bounding sphere, around the middle of its motion, goes in a grid of its
+ * own, in each cell its box touches. A fast body checks the cells its own
+ * swept sphere touches. In a drop nearly everything is fast, so scanning
+ * the whole store for each would be quadratic. Anything a fast body already
+ * overlaps is the solver's.
+ */
+
+#define CCD_MAX_ITERS  16
+#define CCD_JOB_BODIES 8
+
+struct ccd_grid {
+  vec3 min;
+  float cell_size;
+  int n[3];
+  u32 *cell_start;
+  u32 *bodies;
+};
+
+// The cells the box around a sphere touches, clamped into the grid
+void ccd_cells(const ccd_grid *g, vec3 centre, float radius, int *lo,
+               int *hi) {
+  vec3 a = (centre - radius - g->min) / g->cell_size;
+  vec3 b = (centre + radius - g->min) / g->cell_size;
+  for (int k = 0; k < 3; ++k) {
+    lo[k] = glm::clamp((int)floorf(a[k]), 0, g->n[k] - 1);
+    hi[k] = glm::clamp((int)floorf(b[k]), 0, g->n[k] - 1);
+  }
+}
+
+// Sized like the broadphase's grid, on the unswept bounds so one bullet
+// doesn't coarsen it for everyone, with anything outside clamped in
+ccd_grid new_ccd_grid(const vec3 *centres, const float *radii,
+                      iZ num_bodies, float max_bound, vec3 box, arena *mem) {
+  ccd_grid g;
+  float top = box.z;
+  for (iZ i = 0; i < num_bodies; ++i) {
+    top = glm::max(top, centres[i].z);
+  }
+  g.min = vec3(-box.x / 2.0f, -box.y / 2.0f, 0.0f);
+  g.cell_size = 2.0f * max_bound;
+  vec3 size = vec3(box.x, box.y, top);
+  for (int k = 0; k < 3; ++k) {
+    g.n[k] = glm::clamp((int)ceilf(size[k] / g.cell_size), 1,
+                        BROADPHASE_MAX_CELLS);
+  }
+  int num_cells = g.n[0] * g.n[1] * g.n[2];
+
+  // Counted, then filled in body order, so each cell lists its bodies in
+  // order whatever the threads
+  g.cell_start = arena_push<u32>(mem, num_cells + 1);
+  memset(g.cell_start, 0, (uZ)(num_cells + 1) * sizeof(u32));
+  for (iZ i = 0; i < num_bodies; ++i) {
+    int lo[3], hi[3];
+    ccd_cells(&g, centres[i], radii[i], lo, hi);
+    for (int z = lo[2]; z <= hi[2]; ++z) {
+      for (int y = lo[1]; y <= hi[1]; ++y) {
+        for (int x = lo[0]; x <= hi[0]; ++x) {
+          g.cell_start[(z * g.n[1] + y) * g.n[0] + x + 1]++;
+        }
+      }
+    }
+  }
+  for (int c = 0; c < num_cells; ++c) {
+    g.cell_start[c + 1] += g.cell_start[c];
+  }
+  u32 *cursor = arena_push<u32>(mem, num_cells);
+  memcpy(cursor, g.cell_start, (uZ)num_cells * sizeof(u32));
+  g.bodies = arena_push<u32>(mem, g.cell_start[num_cells]);
+  for (iZ i = 0; i < num_bodies; ++i) {
+    int lo[3], hi[3];
+    ccd_cells(&g, centres[i], radii[i], lo, hi);
+    for (int z = lo[2]; z <= hi[2]; ++z) {
+      for (int y = lo[1]; y <= hi[1]; ++y) {
+        for (int x = lo[0]; x <= hi[0]; ++x) {
+          g.bodies[cursor[(z * g.n[1] + y) * g.n[0] + x]++] = (u32)i;
+        }
+      }
+    }
+  }
+  return g;
+}
+
+// How far through the step a can move before it's in contact with b, or
+// with plane if it's given, 1 if it never is. Each moves by its move over
+// the whole step.
+float ccd_fraction(const collision_body *a, vec3 move_a,
+                   const collision_body *b, vec3 move_b,
+                   const container_plane *plane) {
+  collision_body pa = *a;
+  collision_body pb = b ? *b : pa;
+  float t = 0.0f;
+  for (int iter = 0; iter < CCD_MAX_ITERS; ++iter) {
+    pa.position = a->position + t * move_a;
+    float d;
+    float rate;
+    if (plane) {
+      d = collision_ellip_plane(&pa, plane).gap;
+      rate = -glm::dot(move_a, plane->normal);
+    } else {
+      pb.position = b->position + t * move_b;
+      vec3 v;
+      gjk_simplex s;
+      if (!gjk_distance(&pa, &pb, pb.position - pa.position, &v, &s)) {
+        return (iter == 0) ? 1.0f : t;
+      }
+      d = glm::length(v);
+      rate = glm::dot(move_a - move_b, v / d);
+    }
+
+    if (iter == 0 && d <= 0.0f) {
+      return 1.0f;
+    }
+    if (rate <= 0.0f) {
+      return 1.0f;
+    }
+    if (d <= (float)PHYSICS_SLOP) {
+      return glm::min(t + (d + (float)PHYSICS_SLOP) / rate, 1.0f);
+    }
+    t += d / rate;
+    if (t >= 1.0f) {
+      return 1.0f;
+    }
+  }
+  return t;
+}
+
+struct ccd_jobs {
+  collision_body *colliders;
+  vec3 *moves; // Each body's displacement over the step
+  // Each body's swept bounding sphere, around the middle of its motion
+  vec3 *centres;
+  float *radii;
+  ccd_grid grid;
+  const container_plane *planes;
+
+  u32 *fast;
+  iZ num_fast;
+  float *fraction; // Out, for each fast body
+};
+
+void ccd_job(void *data, iZ job, arena *scratch) {
+  ccd_jobs *cj = (ccd_jobs *)data;
+  iZ end = glm::min((job + 1) * CCD_JOB_BODIES, cj->num_fast);
+  for (iZ k = job * CCD_JOB_BODIES; k < end; ++k) {
+    u32 a = cj->fast[k];
+    collision_body *ca = &cj->colliders[a];
+    vec3 move_a = cj->moves[a];
+
+    float fraction = 1.0f;
+    for (int p = 0; p < CONTAINER_PLANES; ++p) {
+      fraction = glm::min(
+          fraction, ccd_fraction(ca, move_a, nullptr, vec3(0.0f),
+                                 &cj->planes[p]));
+    }
+
+    // A body in several of the same cells is only looked at in the first
+    const ccd_grid *g = &cj->grid;
+    vec3 centre_a = cj->centres[a];
+    float radius_a = cj->radii[a];
+    int lo_a[3], hi_a[3];
+    ccd_cells(g, centre_a, radius_a, lo_a, hi_a);
+    for (int z = lo_a[2]; z <= hi_a[2]; ++z) {
+      for (int y = lo_a[1]; y <= hi_a[1]; ++y) {
+        for (int x = lo_a[0]; x <= hi_a[0]; ++x) {
+          int c = (z * g->n[1] + y) * g->n[0] + x;
+          for (u32 i = g->cell_start[c]; i < g->cell_start[c + 1]; ++i) {
+            u32 b = g->bodies[i];
+            vec3 d = cj->centres[b] - centre_a;
+            float r = radius_a + cj->radii[b];
+            if (b == a || glm::dot(d, d) > r * r) {
+              continue;
+            }
+            int lo_b[3], hi_b[3];
+            ccd_cells(g, cj->centres[b], cj->radii[b], lo_b, hi_b);
+            if (x != glm::max(lo_a[0], lo_b[0]) ||
+                y != glm::max(lo_a[1], lo_b[1]) ||
+                z != glm::max(lo_a[2], lo_b[2])) {
+              continue;
+            }
+            fraction = glm::min(fraction,
+                                ccd_fraction(ca, move_a, &cj->colliders[b],
+                                             cj->moves[b], nullptr));
+          }
+        }
+      }
+    }
+    cj->fraction[k] = fraction;
+  }
+}
+
+/*     ======  Solver ======
+ * Sequential impulses with accumulated, clamped normal impulses. The
+ * impulse each contact ends a step with is kept in its cached_contact and
+ * applied up front next step (warm starting), so a resting pile starts every
+ * step already balanced instead of being rebuilt from zero.
+ *
+ * Every contact is between a and b, with the container as an extra static
+ * body at index num_bodies so both kinds go through the same code. Every
+ * body is tested against every container plane at once, in a SIMD pass over
+ * the body store.
+ *
+ * Bodies joined by contacts form islands, which don't affect each other and
+ * are solved as separate jobs. Within an island the contacts keep the order
+ * they'd have in one big sweep, so the result is the same whatever the
+ * number of threads.
+ *
+ * Once every body in an island has been slow for SLEEP_TIME the whole island
+ * goes to sleep. Sleeping bodies still go through the broadphase, but only
+ * to see if an awake body has touched them, which wakes their island again.
+ * Contacts between sleeping bodies keep their cache entries untouched, so
+ * they wake up warm started.
+ *
+ * The two physics_solvers share all of that, and differ in what they do
+ * about overlap. The impulse solver makes contacts rigid in velocity and
+ * then moves bodies apart directly, a bit each step. The soft solver
+ * instead solves each contact as a damped spring over the step (with
+ * Box2D's soft step coefficients), the overlap feeding in as a bias
+ * velocity, and after the positions have moved solves again with no bias so
+ * it doesn't carry over as speed. The rigid contact is the soft one with no
+ * bias, mass_scale 1 and impulse_scale 0, so both go through the same
+ * velocity job.
+ */
+
+// How an overlapping contact is solved,
+//   impulse = -eff_mass * mass_scale * (vn + bias) - impulse_scale * total
+// for bias = max(bias_rate * overlap, -max_bias)
+struct contact_softness {
+  float bias_rate;
+  float max_bias;
+  float mass_scale;
+  float impulse_scale;
+};
+
+const contact_softness CONTACT_RIGID = {
+    .bias_rate = 0.0f, .max_bias = 0.0f, .mass_scale = 1.0f,
+    .impulse_scale = 0.0f};
+
+// A spring of frequency hertz and damping ratio zeta, as stepped implicitly
+// by h
+contact_softness make_softness(float hertz, float zeta, float h) {
+  float omega = (float)TWO_PI * hertz;
+  float a1 = 2.0f * zeta + h * omega;
+  float a2 = h * omega * a1;
+  float a3 = 1.0f / (1.0f + a2);
+  return {.bias_rate = omega / a1, .max_bias = SOFT_MAX_PUSH_SPEED,
+          .mass_scale = a2 * a3, .impulse_scale = a3};
+}
+
+struct solver_contact {
+  u32 a;
+  u32 b;
+  int plane; // Which container plane, when b is the container
+  cached_contact *cached;
+
+  collision_manifold manifold;
+  vec3 ra_n; // r_pa x n_ba
+  vec3 rb_n; // r_pb x n_ba
+  float eff_mass;
+  float bias; // Target separating speed, negative
+  float mass_scale;
+  float impulse_scale;
+};
+
+// Matching entry in the old cache, if there is one. Keys are looked up in
+// increasing order, so the cursor only ever moves forward.
+cached_contact *find_cached(cached_contact **cursor, cached_contact *end,
+                            u64 key) {
+  while (*cursor < end && (*cursor)->key < key) {
+    ++*cursor;
+  }
+  return (*cursor < end && (*cursor)->key == key) ? *cursor : nullptr;
+}
+
+void apply_contact_impulse(solver_contact *c, float impulse, vec3 *lin,
+                           vec3 *ang, float *inv_mass, mat3 *inv_moi) {
+  vec3 n = c->manifold.n_ba;
+  lin[c->a] -= inv_mass[c->a] * impulse * n;
+  ang[c->a] -= inv_moi[c->a] * (impulse * c->ra_n);
+  lin[c->b] += inv_mass[c->b] * impulse * n;
+  ang[c->b] += inv_moi[c->b] * (impulse * c->rb_n);
+}
+
+#define NARROWPHASE_JOB_PAIRS 64
+#define ISLAND_JOB_CONTACTS   128
+
+struct narrowphase_jobs {
+  collision_body *colliders;
+  float *awake;
+  body_pair *pairs;
+  iZ num_pairs;
+
+  vec3 *axes; // Warm start in, separating axis out
+  collision_manifold *manifolds;
+};
+
+void narrowphase_job(void *data, iZ job, arena *scratch) {
+  narrowphase_jobs *np = (narrowphase_jobs *)data;
+  iZ end = glm::min((job + 1) * NARROWPHASE_JOB_PAIRS, np->num_pairs);
+  for (iZ p = job * NARROWPHASE_JOB_PAIRS; p < end; ++p) {
+    body_pair pair = np->pairs[p];
+    if (np->awake[pair.a] == 0.0f && np->awake[pair.b] == 0.0f) {
+      continue;
+    }
+    collision_body *a = &np->colliders[pair.a];
+    collision_body *b = &np->colliders[pair.b];
+    np->manifolds[p] = collision_ellip_ellip(a, b, &np->axes[p]);
+  }
+}
+
+// Contacts and bodies bucketed by island. Island i owns
+//   bodies[body_start[i] .. body_start[i + 1]]
+//   contacts[contact_start[i] .. contact_start[i + 1]]
+// and job j solves islands job_start[j] .. job_start[j + 1].
+struct island_set {
+  iZ num_islands;
+  u32 *bodies;
+  iZ *body_start;
+  solver_contact *contacts;
+  iZ *contact_start;
+  u32 *local; // Each body's index within its island
+
+  iZ num_jobs;
+  iZ *job_start;
+};
+
+u32 island_root(u32 *parent, u32 i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+// Union-find over the contacts, with the smallest body as each root so the
+// island order only depends on body order
+island_set build_islands(solver_contact *contacts, iZ num_contacts,
+                         iZ num_bodies, u32 static_id, arena *mem) {
+  // There are at most as many islands as bodies
+  island_set set;
+  set.bodies = arena_push<u32>(mem, num_bodies);
+  set.body_start = arena_push<iZ>(mem, num_bodies + 1);
+  set.contacts = arena_push<solver_contact>(mem, num_contacts);
+  set.contact_start = arena_push<iZ>(mem, num_bodies + 1);
+  set.local = arena_push<u32>(mem, num_bodies);
+  set.job_start = arena_push<iZ>(mem, num_bodies + 1);
+
+  u32 none = 0xFFFFFFFFu;
+  arena scratch = *mem;
+
+  u32 *parent = arena_push<u32>(&scratch, num_bodies);
+  u32 *island_of = arena_push<u32>(&scratch, num_bodies);
+  for (u32 i = 0; i < (u32)num_bodies; ++i) {
+    parent[i] = i;
+    island_of[i] = none;
+  }
+  for (iZ c = 0; c < num_contacts; ++c) {
+    island_of[contacts[c].a] = 0;
+    if (contacts[c].b != static_id) {
+      island_of[contacts[c].b] = 0;
+      u32 ra = island_root(parent, contacts[c].a);
+      u32 rb = island_root(parent, contacts[c].b);
+      parent[glm::max(ra, rb)] = glm::min(ra, rb);
+    }
+  }
+
+  // Number the islands in body order, counting their bodies as we go
+  u32 *root_island = arena_push<u32>(&scratch, num_bodies);
+  set.num_islands = 0;
+  for (u32 i = 0; i < (u32)num_bodies; ++i) {
+    root_island[i] = none;
+    if (island_of[i] == none) {
+      continue;
+    }
+    u32 r = island_root(parent, i);
+    if (root_island[r] == none) {
+      root_island[r] = (u32)set.num_islands;
+      set.body_start[++set.num_islands] = 0;
+    }
+    island_of[i] = root_island[r];
+    set.body_start[island_of[i] + 1]++;
+  }
+
+  memset(set.contact_start, 0, (uZ)(set.num_islands + 1) * sizeof(iZ));
+  for (iZ c = 0; c < num_contacts; ++c) {
+    set.contact_start[island_of[contacts[c].a] + 1]++;
+  }
+  set.body_start[0] = 0;
+  for (iZ i = 0; i < set.num_islands; ++i) {
+    set.body_start[i + 1] += set.body_start[i];
+    set.contact_start[i + 1] += set.contact_start[i];
+  }
+
+  // Stable scatter, so both keep their original order within an island
+  iZ *cursor = arena_push<iZ>(&scratch, set.num_islands);
+  memcpy(cursor, set.body_start, (uZ)set.num_islands * sizeof(iZ));
+  for (u32 i = 0; i < (u32)num_bodies; ++i) {
+    if (island_of[i] != none) {
+      iZ slot = cursor[island_of[i]]++;
+      set.bodies[slot] = i;
+      set.local[i] = (u32)(slot - set.body_start[island_of[i]]);
+    }
+  }
+  memcpy(cursor, set.contact_start, (uZ)set.num_islands * sizeof(iZ));
+  for (iZ c = 0; c < num_contacts; ++c) {
+    set.contacts[cursor[island_of[contacts[c].a]]++] = contacts[c];
+  }
+
+  // Batch up small islands so jobs are worth handing out
+  set.num_jobs = 0;
+  iZ job_contacts = 0;
+  for (iZ i = 0; i < set.num_islands; ++i) {
+    if (job_contacts == 0) {
+      set.job_start[set.num_jobs++] = i;
+    }
+    job_contacts += set.contact_start[i + 1] - set.contact_start[i];
+    if (job_contacts >= ISLAND_JOB_CONTACTS) {
+      job_contacts = 0;
+    }
+  }
+  set.job_start[set.num_jobs] = set.num_islands;
+
+  return set;
+}
+
+struct island_jobs {
+  island_set *islands;
+  int iterations;
+  contact_softness softness;
+  bool warm_start;
+  u32 static_id;
+  const container_plane *planes;
 
-    dynamics[i].linear_velocity +=
-        (type.inv_mass) ? dt * vec3(0.0f, 0.0f, gravity) : vec3(0.0f);
+  collision_body *colliders;
+  vec3 *lin;
+  vec3 *ang;
+  float *inv_mass;
+  mat3 *inv_moi;
+};
+
+// Warm start and velocity iterations. Each island works on its own copy of
+// its bodies in the worker's scratch, with the container as the last one.
+void island_velocity_job(void *data, iZ job, arena *mem) {
+  island_jobs *ij = (island_jobs *)data;
+  island_set *set = ij->islands;
+  contact_softness soft = ij->softness;
+
+  for (iZ island = set->job_start[job]; island < set->job_start[job + 1];
+       ++island) {
+    arena scratch = *mem;
+    u32 *bodies = set->bodies + set->body_start[island];
+    iZ nb = set->body_start[island + 1] - set->body_start[island];
+    iZ nc = set->contact_start[island + 1] - set->contact_start[island];
+
+    vec3 *lin = arena_push<vec3>(&scratch, nb + 1);
+    vec3 *ang = arena_push<vec3>(&scratch, nb + 1);
+    float *inv_mass = arena_push<float>(&scratch, nb + 1);
+    mat3 *inv_moi = arena_push<mat3>(&scratch, nb + 1);
+    for (iZ i = 0; i < nb; ++i) {
+      lin[i] = ij->lin[bodies[i]];
+      ang[i] = ij->ang[bodies[i]];
+      inv_mass[i] = ij->inv_mass[bodies[i]];
+      inv_moi[i] = ij->inv_moi[bodies[i]];
+    }
+    lin[nb] = ang[nb] = vec3(0.0f);
+    inv_mass[nb] = 0.0f;
+    inv_moi[nb] = mat3(0.0f);
+
+    solver_contact *contacts = arena_push<solver_contact>(&scratch, nc);
+    for (iZ i = 0; i < nc; ++i) {
+      solver_contact *c = &contacts[i];
+      *c = set->contacts[set->contact_start[island] + i];
+      c->a = set->local[c->a];
+      c->b = (c->b == ij->static_id) ? (u32)nb : set->local[c->b];
 
-    // No active forces or torques yet (other than gravity), so this is useless.
-    // dynamics[i].linear_velocity += dt * type.inv_mass * dynamics[i].force;
-    // dynamics[i].angular_velocity += dt * inv_moi_world * dynamics[i].torque;
+      // Warm start
+      vec3 n = c->manifold.n_ba;
+      c->ra_n = glm::cross(c->manifold.r_pa, n);
+      c->rb_n = glm::cross(c->manifold.r_pb, n);
+      c->eff_mass = 1.0f / (inv_mass[c->a] + inv_mass[c->b] +
+                            glm::dot(c->ra_n, inv_moi[c->a] * c->ra_n) +
+                            glm::dot(c->rb_n, inv_moi[c->b] * c->rb_n));
+
+      // Only past the slop, like the position solve
+      float overlap = c->manifold.gap + (float)PHYSICS_SLOP;
+      contact_softness cs = (overlap < 0.0f) ? soft : CONTACT_RIGID;
+      c->bias = glm::max(cs.bias_rate * overlap, -cs.max_bias);
+      c->mass_scale = cs.mass_scale;
+      c->impulse_scale = cs.impulse_scale;
+
+      if (ij->warm_start) {
+        apply_contact_impulse(c, c->cached->normal_impulse, lin, ang,
+                              inv_mass, inv_moi);
+      }
+    }
+
+    // Solve velocity constraints
+    for (int iter = 0; iter < ij->iterations; ++iter) {
+      for (iZ i = 0; i < nc; ++i) {
+        solver_contact *c = &contacts[i];
+        vec3 dv = (lin[c->b] + glm::cross(ang[c->b], c->manifold.r_pb)) -
+                  (lin[c->a] + glm::cross(ang[c->a], c->manifold.r_pa));
+        float vn = glm::dot(dv, c->manifold.n_ba);
+
+        // Total impulse can only ever push apart
+        float old_impulse = c->cached->normal_impulse;
+        float impulse = -c->eff_mass * c->mass_scale * (vn + c->bias) -
+                        c->impulse_scale * old_impulse;
+        float new_impulse = glm::max(old_impulse + impulse, 0.0f);
+        c->cached->normal_impulse = new_impulse;
+        apply_contact_impulse(c, new_impulse - old_impulse, lin, ang,
+                              inv_mass, inv_moi);
+      }
+    }
 
-    dynamics[i].linear_velocity.z += (type.inv_mass) ? dt * gravity : 0.0f;
+    for (iZ i = 0; i < nb; ++i) {
+      ij->lin[bodies[i]] = lin[i];
+      ij->ang[bodies[i]] = ang[i];
+    }
+  }
+}
+
+// Solve position constraints, leaving PHYSICS_SLOP of overlap so resting
+// contacts (and their cached impulses) survive to the next step. Only
+// POSITION_CORRECTION of each overlap goes in one pass, taking all of it
+// overshoots in a pile, which then never stops jittering. Islands don't
+// share bodies, so this works on the shared arrays directly.
+void island_position_job(void *data, iZ job, arena *mem) {
+  island_jobs *ij = (island_jobs *)data;
+  island_set *set = ij->islands;
+  collision_body *colliders = ij->colliders;
+  float *inv_mass = ij->inv_mass;
+
+  for (iZ island = set->job_start[job]; island < set->job_start[job + 1];
+       ++island) {
+    iZ first = set->contact_start[island];
+    iZ last = set->contact_start[island + 1];
+    for (iZ i = first; i < last; ++i) {
+      solver_contact *c = &set->contacts[i];
+      collision_body *a = &colliders[c->a];
+
+      collision_manifold m;
+      if (c->b == ij->static_id) {
+        m = collision_ellip_plane(a, &ij->planes[c->plane]);
+      } else {
+        m = collision_ellip_ellip(a, &colliders[c->b], &c->cached->axis);
+      }
+
+      float error = POSITION_CORRECTION * (m.gap + (float)PHYSICS_SLOP);
+      if (error < 0.0f) {
+        // Split the correction by inverse mass
+        float share_a = inv_mass[c->a] / (inv_mass[c->a] + inv_mass[c->b]);
+        a->position += error * share_a * m.n_ba;
+        if (c->b != ij->static_id) {
+          colliders[c->b].position -= error * (1.0f - share_a) * m.n_ba;
+        }
+      }
+    }
   }
+}
 
-  // Solve velocity constraints
+int compare_cached_contacts(const void *a, const void *b) {
+  u64 x = ((const cached_contact *)a)->key;
+  u64 y = ((const cached_contact *)b)->key;
+  return (x > y) - (x < y);
+}
+
+void remap_contacts(array<cached_contact> *cache, const u32 *remap) {
+  cached_contact *out = cache->base;
+  bool sorted = true;
+  for (cached_contact *c = cache->base; c != cache->tail; ++c) {
+    u32 a = remap[c->key >> 32];
+    u32 b = (u32)c->key;
+    if (b < CONTACT_PLANE) {
+      b = remap[b];
+    }
+    if (a == BODY_REMOVED || b == BODY_REMOVED) {
+      continue;
+    }
+    cached_contact next = *c;
+    if (a > b) {
+      // The axis points from a to b
+      u32 t = a;
+      a = b;
+      b = t;
+      next.axis = -next.axis;
+    }
+    next.key = (u64)a << 32 | b;
+    sorted &= out == cache->base || (out - 1)->key < next.key;
+    *out++ = next;
+  }
+  cache->tail = out;
+  if (!sorted) {
+    qsort(cache->base, (uZ)cache->size(), sizeof(cached_contact),
+          compare_cached_contacts);
+  }
+}
+
+void container_planes(vec3 box, container_plane *planes) {
+  planes[0] = {.normal = vec3(0.0f, 0.0f, 1.0f), .offset = 0.0f};
+  planes[1] = {.normal = vec3(1.0f, 0.0f, 0.0f), .offset = -box.x / 2.0f};
+  planes[2] = {.normal = vec3(-1.0f, 0.0f, 0.0f), .offset = -box.x / 2.0f};
+  planes[3] = {.normal = vec3(0.0f, 1.0f, 0.0f), .offset = -box.y / 2.0f};
+  planes[4] = {.normal = vec3(0.0f, -1.0f, 0.0f), .offset = -box.y / 2.0f};
+}
+
+int choose_substeps(const physics_params *params, physics_step_stats last,
+                    int last_substeps, float dt) {
+  float travel = last.max_speed * dt;
+  int substeps = (int)ceilf(travel / SUBSTEP_MAX_TRAVEL);
+
+  // Overlap only comes down a tick or two after substeps go up, so it steps
+  // one at a time and holds in between rather than see-sawing
+  float penetration = last.max_penetration;
+  if (penetration > SUBSTEP_MAX_PENETRATION) {
+    substeps = glm::max(substeps, last_substeps + 1);
+  } else if (penetration > SUBSTEP_MAX_PENETRATION / 2.0f) {
+    substeps = glm::max(substeps, last_substeps);
+  } else {
+    substeps = glm::max(substeps, last_substeps - 1);
+  }
+  substeps = glm::clamp(substeps, params->substeps, params->max_substeps);
+  if (params->solver == SOLVER_SOFT) {
+    substeps = glm::max(substeps, SOFT_MIN_SUBSTEPS);
+  }
+  return substeps;
+}
+
+physics_step_stats physics_step(body_store *bodies,
+                                array<cached_contact> *cache,
+                                const physics_params *params, job_pool *jobs,
+                                float dt, merge_queue *merges,
+                                arena *mem_temp) {
+  TRACE_PHASES(phase, "integrate");
+  arena scratch = *mem_temp;
+  float gravity = -10.0f;
+  iZ num_bodies = bodies->num;
+
+  container_plane planes[CONTAINER_PLANES];
+  container_planes(params->box, planes);
+
+  // No active forces or torques yet (other than gravity)
+  integrate_velocities_kernel<lanes_simd>(bodies, dt, gravity);
+
+  // Solver copy of each body, plus the static container. The collision code
+  // works on whole bodies at random, so it gets them gathered. The world
+  // space matrices are the ones the last step left in the store.
+  u32 static_id = (u32)num_bodies;
+  collision_body *colliders = arena_push<collision_body>(&scratch, num_bodies);
+  vec3 *lin = arena_push<vec3>(&scratch, num_bodies + 1);
+  vec3 *ang = arena_push<vec3>(&scratch, num_bodies + 1);
+  float *inv_mass = arena_push<float>(&scratch, num_bodies + 1);
+  mat3 *inv_moi = arena_push<mat3>(&scratch, num_bodies + 1);
   for (int i = 0; i < num_bodies; ++i) {
-    collision_manifold floor_test =
-        collision_ellip_plane(&(fruit[i]), vec3(0.0f), vec3(0.0f, 0.0f, 1.0f));
+    colliders[i] = load_collision_body(bodies, i);
+    lin[i] = vec3(bodies->vx[i], bodies->vy[i], bodies->vz[i]);
+    ang[i] = vec3(bodies->wx[i], bodies->wy[i], bodies->wz[i]);
+    inv_mass[i] = bodies->inv_mass[i];
+    inv_moi[i] = load_inv_moi(bodies, i);
+  }
+  lin[static_id] = ang[static_id] = vec3(0.0f);
+  inv_mass[static_id] = 0.0f;
+  inv_moi[static_id] = mat3(0.0f);
+
+  TRACE_NEXT(phase, "broadphase");
+  iZ dropped_pairs;
+  array<body_pair> pairs = broadphase_pairs(colliders, num_bodies,
+                                            params->box, &scratch,
+                                            &dropped_pairs);
 
-    if (floor_test.gap <= 0.0f) {
-      const fruit_type &type = TABLE_fruit_type[fruit[i].id];
+  TRACE_NEXT(phase, "narrowphase");
 
-      mat3 inv_moi_world = fruit[i].body.orientation * type.inv_moi *
-                           glm::transpose(fruit[i].body.orientation);
+  // Narrowphase, warm started from the cached axes. Pairs and the cache are
+  // both sorted by key, so the old cache is merge-walked alongside.
+  narrowphase_jobs np;
+  np.colliders = colliders;
+  np.awake = bodies->awake;
+  np.pairs = pairs.base;
+  np.num_pairs = pairs.size();
+  np.axes = arena_push<vec3>(&scratch, pairs.size());
+  np.manifolds = arena_push<collision_manifold>(&scratch, pairs.size());
+  cached_contact **prev = arena_push<cached_contact *>(&scratch, pairs.size());
+  cached_contact *old = cache->base;
+  for (iZ p = 0; p < pairs.size(); ++p) {
+    u64 key = (u64)pairs.base[p].a << 32 | pairs.base[p].b;
+    prev[p] = find_cached(&old, cache->tail, key);
+    np.axes[p] = prev[p] ? prev[p]->axis : vec3(0.0f);
+  }
 
-      vec3 n = -floor_test.n_ba;
-      vec3 r = floor_test.r_pa;
-        
-      printf("%.2f\n", floor_test.gap);
-      //printf("%.2f,%.2f,%.2f\n",  r.x, r.y, r.z);
+  // Awake bodies touching sleeping ones wake them (and the rest of their
+  // island) before anything is solved
+  for (iZ p = 0; p < pairs.size(); ++p) {
+    u32 a = pairs.base[p].a;
+    u32 b = pairs.base[p].b;
+    if ((bodies->awake[a] == 0.0f) != (bodies->awake[b] == 0.0f)) {
+      vec3 axis = np.axes[p];
+      collision_manifold m =
+          collision_ellip_ellip(&colliders[a], &colliders[b], &axis);
+      if (m.gap <= 0.0f) {
+        wake_body(bodies, a);
+        wake_body(bodies, b);
+      }
+    }
+  }
 
-      float inv_mass =
-          type.inv_mass +
-          glm::dot(n, glm::cross(inv_moi_world * glm::cross(r, n), r));
+  iZ num_np_jobs =
+      (pairs.size() + NARROWPHASE_JOB_PAIRS - 1) / NARROWPHASE_JOB_PAIRS;
+  job_pool_run(jobs, narrowphase_job, &np, num_np_jobs);
 
-      vec3 dv = dynamics[i].linear_velocity +
-                glm::cross(dynamics[i].angular_velocity, r);
+  TRACE_NEXT(phase, "contacts");
+  float *plane_gaps[CONTAINER_PLANES];
+  for (float *&gaps : plane_gaps) {
+    gaps = push_lane_array(&scratch, bodies->cap);
+  }
+  container_gaps_kernel<lanes_simd>(bodies, planes, plane_gaps);
 
-      float vn = glm::dot(dv, n);
-      float impulse = vn / inv_mass;
+  // Each body's pairs then its plane contacts, which keeps keys sorted for
+  // next step. Pair axes are cached even when apart, to warm start the
+  // narrowphase, and sleeping contacts are carried over as they were.
+  iZ max_contacts = pairs.size() + num_bodies * CONTAINER_PLANES;
+  array<cached_contact> next_cache =
+      new_array<cached_contact>(&scratch, max_contacts);
+  array<solver_contact> contacts =
+      new_array<solver_contact>(&scratch, max_contacts);
+  old = cache->base;
+  iZ p = 0;
+  for (u32 a = 0; a < (u32)num_bodies; ++a) {
+    bool asleep = bodies->awake[a] == 0.0f;
+    for (; p < pairs.size() && pairs.base[p].a == a; ++p) {
+      u32 b = pairs.base[p].b;
+      if (asleep && bodies->awake[b] == 0.0f) {
+        if (prev[p]) {
+          next_cache.push(*prev[p]);
+        }
+        continue;
+      }
+      collision_manifold m = np.manifolds[p];
 
+      cached_contact c;
+      c.key = (u64)a << 32 | b;
+      c.axis = np.axes[p];
+      c.normal_impulse =
+          (m.gap <= 0.0f && prev[p]) ? prev[p]->normal_impulse : 0.0f;
+      next_cache.push(c);
+      if (m.gap <= 0.0f) {
+        contacts.push({.a = a, .b = b, .plane = 0,
+                       .cached = next_cache.tail - 1, .manifold = m});
+        if (merges && bodies->id[a] == bodies->id[b] &&
+            bodies->id[a] < params->merge_ids && !merges->queued[a] &&
+            !merges->queued[b]) {
+          merges->pairs.push({.a = a, .b = b});
+          merges->queued[a] = merges->queued[b] = 1;
+        }
+      }
+    }
+
+    for (int k = 0; k < CONTAINER_PLANES; ++k) {
+      u64 key = (u64)a << 32 | (CONTACT_PLANE + (u32)k);
+      cached_contact *prev_plane = find_cached(&old, cache->tail, key);
+      if (asleep) {
+        if (prev_plane) {
+          next_cache.push(*prev_plane);
+        }
+        continue;
+      }
+      if (plane_gaps[k][a] > 0.0f) {
+        continue;
+      }
+
+      collision_manifold m = collision_ellip_plane(&colliders[a], &planes[k]);
+      cached_contact c;
+      c.key = key;
+      c.axis = m.n_ba;
+      c.normal_impulse = prev_plane ? prev_plane->normal_impulse : 0.0f;
+      next_cache.push(c);
+      contacts.push({.a = a, .b = static_id, .plane = k,
+                     .cached = next_cache.tail - 1, .manifold = m});
+    }
+  }
+
+  physics_step_stats stats = {.max_speed = 0.0f,
+                              .max_penetration = 0.0f,
+                              .dropped_pairs = dropped_pairs};
+  for (iZ i = 0; i < contacts.size(); ++i) {
+    stats.max_penetration =
+        glm::max(stats.max_penetration, -contacts.base[i].manifold.gap);
+  }
+
+  TRACE_NEXT(phase, "velocity solve");
+  island_set islands = build_islands(contacts.base, contacts.size(),
+                                     num_bodies, static_id, &scratch);
+  island_jobs ij;
+  ij.islands = &islands;
+  ij.iterations = params->iterations;
+  ij.softness = (params->solver == SOLVER_SOFT)
+                    ? make_softness(glm::min(SOFT_CONTACT_HERTZ, 0.25f / dt),
+                                    SOFT_CONTACT_DAMPING, dt)
+                    : CONTACT_RIGID;
+  ij.warm_start = true;
+  ij.static_id = static_id;
+  ij.planes = planes;
+  ij.colliders = colliders;
+  ij.lin = lin;
+  ij.ang = ang;
+  ij.inv_mass = inv_mass;
+  ij.inv_moi = inv_moi;
+
+  job_pool_run(jobs, island_velocity_job, &ij, islands.num_jobs);
+
+  // Contacts have no friction, so nothing else would ever stop a ball
+  // spinning in a pile
+  float rest_damping = 1.0f / (1.0f + dt * REST_ANGULAR_DAMPING);
+  for (iZ i = 0; i < islands.body_start[islands.num_islands]; ++i) {
+    ang[islands.bodies[i]] *= rest_damping;
+  }
 
-      dynamics[i].linear_velocity -= type.inv_mass * impulse * n;
-      dynamics[i].angular_velocity -=
-          inv_moi_world * impulse * glm::cross(r, n);
+  for (int i = 0; i < num_bodies; ++i) {
+    bodies->vx[i] = lin[i].x;
+    bodies->vy[i] = lin[i].y;
+    bodies->vz[i] = lin[i].z;
+    bodies->wx[i] = ang[i].x;
+    bodies->wy[i] = ang[i].y;
+    bodies->wz[i] = ang[i].z;
+    if (bodies->awake[i] != 0.0f) {
+      stats.max_speed = glm::max(stats.max_speed, glm::length(lin[i]));
     }
   }
 
-  // Integrate positions
+  TRACE_NEXT(phase, "ccd");
+  ccd_jobs cj;
+  cj.colliders = colliders;
+  cj.moves = arena_push<vec3>(&scratch, num_bodies);
+  cj.centres = arena_push<vec3>(&scratch, num_bodies);
+  cj.radii = arena_push<float>(&scratch, num_bodies);
+  cj.planes = planes;
+  cj.fast = arena_push<u32>(&scratch, num_bodies);
+  cj.num_fast = 0;
+  float max_bound = 0.0f;
   for (int i = 0; i < num_bodies; ++i) {
-    fruit[i].body.position += dt * dynamics[i].linear_velocity;
+    vec3 move = dt * vec3(bodies->vx[i], bodies->vy[i], bodies->vz[i]);
+    cj.moves[i] = move;
+    cj.centres[i] = colliders[i].position + 0.5f * move;
+    cj.radii[i] = colliders[i].bound + 0.5f * glm::length(move);
+    max_bound = glm::max(max_bound, colliders[i].bound);
 
-    float w1, w2, w3;
-    w1 = dynamics[i].angular_velocity[0];
-    w2 = dynamics[i].angular_velocity[1];
-    w3 = dynamics[i].angular_velocity[2];
-    mat3 ang_screw(0.0f, -w3, w2, w3, 0.0f, -w1, -w2, w1, 0.0);
-    mat3 R = fruit[i].body.orientation;
+    float radius2 = glm::min(glm::min(bodies->radii2[0][i],
+                                      bodies->radii2[1][i]),
+                             bodies->radii2[2][i]);
+    if (glm::dot(move, move) > CCD_MIN_TRAVEL * CCD_MIN_TRAVEL * radius2) {
+      cj.fast[cj.num_fast++] = (u32)i;
+    }
+  }
+  if (cj.num_fast > 0) {
+    cj.grid = new_ccd_grid(cj.centres, cj.radii, num_bodies, max_bound,
+                           params->box, &scratch);
+  }
+  cj.fraction = arena_push<float>(&scratch, cj.num_fast);
+  job_pool_run(jobs, ccd_job, &cj,
+               (cj.num_fast + CCD_JOB_BODIES - 1) / CCD_JOB_BODIES);
 
-    R += dt * ang_screw * R;
+  // Fast bodies only go as far as their first contact, the velocities they
+  // had are put back after
+  for (iZ k = 0; k < cj.num_fast; ++k) {
+    u32 i = cj.fast[k];
+    float f = cj.fraction[k];
+    bodies->vx[i] *= f;
+    bodies->vy[i] *= f;
+    bodies->vz[i] *= f;
+    bodies->wx[i] *= f;
+    bodies->wy[i] *= f;
+    bodies->wz[i] *= f;
+  }
 
-    renormalise(R);
-    fruit[i].body.orientation = R;
+  TRACE_NEXT(phase, "position integrate");
+  integrate_positions_kernel<lanes_simd>(bodies, dt);
+  for (iZ k = 0; k < cj.num_fast; ++k) {
+    u32 i = cj.fast[k];
+    bodies->vx[i] = lin[i].x;
+    bodies->vy[i] = lin[i].y;
+    bodies->vz[i] = lin[i].z;
+    bodies->wx[i] = ang[i].x;
+    bodies->wy[i] = ang[i].y;
+    bodies->wz[i] = ang[i].z;
   }
+  world_matrices_kernel<lanes_simd>(bodies);
+
+  if (params->solver == SOLVER_SOFT) {
+    TRACE_NEXT(phase, "relax");
+    ij.iterations = SOFT_RELAX_ITERATIONS;
+    ij.softness = CONTACT_RIGID;
+    ij.warm_start = false;
+    job_pool_run(jobs, island_velocity_job, &ij, islands.num_jobs);
 
-  // Solve position constraints
+    for (int i = 0; i < num_bodies; ++i) {
+      if (bodies->awake[i] != 0.0f) {
+        bodies->vx[i] = lin[i].x;
+        bodies->vy[i] = lin[i].y;
+        bodies->vz[i] = lin[i].z;
+        bodies->wx[i] = ang[i].x;
+        bodies->wy[i] = ang[i].y;
+        bodies->wz[i] = ang[i].z;
+      }
+    }
+  } else {
+    TRACE_NEXT(phase, "position solve");
+    for (int i = 0; i < num_bodies; ++i) {
+      colliders[i] = load_collision_body(bodies, i);
+    }
+
+    job_pool_run(jobs, island_position_job, &ij, islands.num_jobs);
+
+    for (int i = 0; i < num_bodies; ++i) {
+      bodies->px[i] = colliders[i].position.x;
+      bodies->py[i] = colliders[i].position.y;
+      bodies->pz[i] = colliders[i].position.z;
+    }
+  }
+
+  // Slow is by how fast a body has moved and turned on average since it
+  // slowed down, at least over SLEEP_TIME, not by its speed now. In a deep
+  // pile the solver leaves some of gravity's speed in each step, which the
+  // position solve or the next step's contacts take back out, so bodies that
+  // are going nowhere still jitter.
   for (int i = 0; i < num_bodies; ++i) {
-    collision_manifold floor_test =
-        collision_ellip_plane(&(fruit[i]), vec3(0.0f), vec3(0.0f, 0.0f, 1.0f));
-
-    if (floor_test.gap <= 0.0f) {
-      fruit[i].body.position += floor_test.gap * floor_test.n_ba;
-    }
-  }
-}
-
-void renormalise(mat3 &M) // Re-normalizes nearly orthonormal matrix
-{
-  double alpha = M[0][0] * M[0][0] + M[1][0] * M[1][0] +
-                 M[2][0] * M[2][0]; // First column's norm squared
-  double beta = M[0][1] * M[0][1] + M[1][1] * M[1][1] +
-                M[2][1] * M[2][1]; // Second column's norm squared
-  double gamma = M[0][2] * M[0][2] + M[1][2] * M[1][2] +
-                 M[2][2] * M[2][2];  // Third column's norm squared
-  alpha = 1.0 - 0.5 * (alpha - 1.0); // Get mult. factor
-  beta = 1.0 - 0.5 * (beta - 1.0);
-  gamma = 1.0 - 0.5 * (gamma - 1.0);
-  M[0][0] *= alpha;
-  M[1][0] *= alpha;
-  M[2][0] *= alpha;
-  M[0][1] *= beta;
-  M[1][1] *= beta;
-  M[2][1] *= beta;
-  M[0][2] *= gamma;
-  M[1][2] *= gamma;
-  M[2][2] *= gamma;
-  alpha = M[0][0] * M[0][1] + M[1][0] * M[1][1] +
-          M[2][0] * M[2][1]; // First and second column dot product
-  beta = M[0][0] * M[0][2] + M[1][0] * M[1][2] +
-         M[2][0] * M[2][2]; // First and third column dot product
-  gamma = M[0][1] * M[0][2] + M[1][1] * M[1][2] +
-          M[2][1] * M[2][2]; // Second and third column dot product
-  alpha *= 0.5;
-  beta *= 0.5;
-  gamma *= 0.5;
-  double temp1, temp2;
-  temp1 = M[0][0] - alpha * M[0][1] - beta * M[0][2]; // Update row1
-  temp2 = M[0][1] - alpha * M[0][0] - gamma * M[0][2];
-  M[0][2] -= beta * M[0][0] + gamma * M[0][1];
-  M[0][0] = temp1;
-  M[0][1] = temp2;
-  temp1 = M[1][0] - alpha * M[1][1] - beta * M[1][2]; // Update row2
-  temp2 = M[1][1] - alpha * M[1][0] - gamma * M[1][2];
-  M[1][2] -= beta * M[1][0] + gamma * M[1][1];
-  M[1][0] = temp1;
-  M[1][1] = temp2;
-  temp1 = M[2][0] - alpha * M[2][1] - beta * M[2][2]; // Update row3
-  temp2 = M[2][1] - alpha * M[2][0] - gamma * M[2][2];
-  M[2][2] -= beta * M[2][0] + gamma * M[2][1];
-  M[2][0] = temp1;
-  M[2][1] = temp2;
+    vec3 p = vec3(bodies->px[i], bodies->py[i], bodies->pz[i]);
+    quat q = quat(bodies->qw[i], bodies->qx[i], bodies->qy[i], bodies->qz[i]);
+    if (bodies->sleep_time[i] == 0.0f) {
+      bodies->rest_px[i] = p.x;
+      bodies->rest_py[i] = p.y;
+      bodies->rest_pz[i] = p.z;
+      bodies->rest_qx[i] = q.x;
+      bodies->rest_qy[i] = q.y;
+      bodies->rest_qz[i] = q.z;
+      bodies->rest_qw[i] = q.w;
+    }
+    float t = glm::max(bodies->sleep_time[i] + dt, SLEEP_TIME);
+    float drift = SLEEP_LINEAR_SPEED * t;
+    vec3 move = p - vec3(bodies->rest_px[i], bodies->rest_py[i],
+                         bodies->rest_pz[i]);
+
+    // Half the angle turned through, from the dot of the two quaternions
+    float half_turn = glm::min(0.5f * SLEEP_ANGULAR_SPEED * t, 1.5f);
+    quat rest_q = quat(bodies->rest_qw[i], bodies->rest_qx[i],
+                       bodies->rest_qy[i], bodies->rest_qz[i]);
+    bool slow = glm::dot(move, move) < drift * drift &&
+                fabsf(glm::dot(q, rest_q)) > cosf(half_turn);
+    bodies->sleep_time[i] = slow ? bodies->sleep_time[i] + dt : 0.0f;
+  }
+
+  // Islands only sleep as a whole, once all their bodies have been slow for
+  // long enough
+  for (iZ island = 0; island < islands.num_islands; ++island) {
+    u32 *island_bodies = islands.bodies + islands.body_start[island];
+    iZ n = islands.body_start[island + 1] - islands.body_start[island];
+    bool sleepy = true;
+    for (iZ i = 0; i < n; ++i) {
+      sleepy &= bodies->sleep_time[island_bodies[i]] >= SLEEP_TIME;
+    }
+    if (!sleepy) {
+      continue;
+    }
+    for (iZ i = 0; i < n; ++i) {
+      u32 b = island_bodies[i];
+      bodies->awake[b] = 0.0f;
+      bodies->sleep_island[b] = island_bodies[0];
+      bodies->vx[b] = bodies->vy[b] = bodies->vz[b] = 0.0f;
+      bodies->wx[b] = bodies->wy[b] = bodies->wz[b] = 0.0f;
+    }
+  }
+
+  // Can't outgrow it while the pairs are capped, but warm starts are all
+  // that's lost if it ever does
+  ASSERT(next_cache.size() <= cache->cap);
+  cache->clear();
+  for (iZ i = 0; i < glm::min(next_cache.size(), cache->cap); ++i) {
+    cache->push(next_cache.base[i]);
+  }
+  return stats;
 }
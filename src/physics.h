@@ -1,15 +1,12 @@
 #pragma once
 
 #include "types.h"
+#include "jobs.h"
+#include "simd.h"
 
 struct rigidbody {
   vec3 position;
-  mat3 orientation;
-};
-
-struct body_dynamics {
-  vec3 linear_velocity;
-  vec3 angular_velocity;
+  quat orientation; // Unit length
 };
 
 struct fruit_body {
@@ -18,6 +15,227 @@ struct fruit_body {
   u32 id;
 };
 
+// Names one body for as long as it exists, wherever removals move it to in
+// the store. The low bits pick an entry in the store's handle table, the
+// rest are that entry's generation, which goes up every time the entry is
+// freed so old handles stop resolving. Only the generation's low 16 bits
+// are kept, so a handle held while its entry is freed 65536 times resolves
+// again, to whatever body has the entry then. Handles are for the fruit
+// something is following now, not for keeping across a game.
+struct body_handle {
+  u32 bits;
+};
+
+#define BODY_HANDLE_INDEX_BITS 16
+#define BODY_HANDLE_INDEX_MASK ((1u << BODY_HANDLE_INDEX_BITS) - 1)
+#define BODY_HANDLE_NONE       0xFFFFFFFFu // End of the free list
+
+// Structure of arrays body storage, what the physics actually steps.
+// Every array is SIMD_ALIGN aligned and has room for num rounded up to
+// SIMD_MAX_WIDTH, so kernels can always run over whole vectors.
+struct body_store {
+  float *px, *py, *pz;
+  float *qx, *qy, *qz, *qw; // Orientation, a unit quaternion
+  float *vx, *vy, *vz;
+  float *wx, *wy, *wz;
+  float *inv_mass;
+  u32 *id;
+
+  // World space matrices, kept up to date with the orientation by the
+  // kernels, the only place it's made into a rotation matrix. Both are
+  // symmetric, stored as xx yy zz xy xz yz.
+  float *shape[6];   // R * A * A * R^T, for radii A
+  float *inv_moi[6]; // R * I^-1 * R^T
+  // And the body space diagonals they come from
+  float *radii2[3];
+  float *inv_moi_local[3];
+  float *bound; // Bounding sphere radius
+
+  // Sleeping bodies are left out of the solver and don't move. awake is 1 or
+  // 0 so kernels can mask with it.
+  float *awake;
+  float *sleep_time;  // How long the body has been slow enough to sleep
+  // Where it was when it slowed down
+  float *rest_px, *rest_py, *rest_pz;
+  float *rest_qx, *rest_qy, *rest_qz, *rest_qw;
+  u32 *sleep_island; // Bodies that fell asleep together wake together
+
+  // Each body's handle table entry, which moves with it like the rest. The
+  // table has an entry per slot, holding where its body is or, if it's
+  // free, the next free entry.
+  u32 *handle;
+  u32 *handle_body;
+  u32 *handle_generation;
+  u32 handle_free;
+
+  iZ num;
+  iZ cap;
+};
+
+body_store new_body_store(arena *, iZ cap);
+body_handle body_store_push(body_store *, vec3 position, quat orientation,
+                            u32 id);
+// Replaces the body in slot i with a new one, at rest, with a new handle
+body_handle body_store_set(body_store *, iZ i, vec3 position,
+                           quat orientation, u32 id);
+
+body_handle body_store_handle(const body_store *, iZ i);
+// Where the body is in the store, or -1 once it's been removed
+iZ body_store_lookup(const body_store *, body_handle);
+
+#define BODY_REMOVED 0xFFFFFFFFu
+
+// Removes all the bodies at removed (ascending, no repeats) in one pass,
+// filling the gaps with bodies from the end. remap gets each old index's new
+// one, or BODY_REMOVED. Sleeping islands any of them were in have to be
+// woken first.
+void body_store_remove(body_store *, const u32 *removed, iZ num_removed,
+                       u32 *remap);
+
+fruit_body load_body(const body_store *, iZ i);
+void store_orientation(body_store *, iZ i, quat orientation);
+vec3 load_linear_velocity(const body_store *, iZ i);
+mat3 load_inv_moi(const body_store *, iZ i);
+
+void wake_body(body_store *, iZ i);
+iZ count_awake(const body_store *);
+
+// Hash of every body's position and orientation, to compare runs exactly
+u64 body_store_checksum(const body_store *);
+
+// Everything the collision code needs of a body, in world space
+struct collision_body {
+  vec3 position;
+  mat3 shape; // R * A * A * R^T, for radii A
+  float bound;
+};
+
+collision_body load_collision_body(const body_store *, iZ i);
+collision_body make_collision_body(const fruit_body *);
+
+// The container, the floor and four walls. Points inside have
+// dot(p, normal) >= offset.
+struct container_plane {
+  vec3 normal;
+  float offset;
+};
+
+#define CONTAINER_PLANES 5
+
+// Candidate pair from the broadphase, always a < b
+struct body_pair {
+  u32 a;
+  u32 b;
+};
+
+// Contact state kept between steps, keyed by a << 32 | b
+// b is CONTACT_PLANE + k for contacts with container plane k
+struct cached_contact {
+  u64 key;
+  vec3 axis;
+
+  float normal_impulse; // Accumulated over the step, for warm starting
+};
+
+#define CONTACT_PLANE 0xFFFFFFF0u
+
+// Moves the cache over to new body indices after body_store_remove, keeping
+// it sorted. Contacts of bodies remapped to BODY_REMOVED are dropped.
+void remap_contacts(array<cached_contact> *, const u32 *remap);
+
+// How physics_step solves contacts, picked when the game is created
+enum physics_solver : u8 {
+  // Rigid velocity constraints, then a separate pass that pushes overlapping
+  // bodies back apart
+  SOLVER_IMPULSE,
+  // Soft step. Contacts are stiff damped springs, solved in velocity with a
+  // bias that takes overlap out over a few steps, then relaxed without it
+  // once positions have moved so the bias doesn't stay on as speed. Needs
+  // two or more substeps, at one a tick deep overlaps can blow it up, so
+  // choose_substeps never gives it fewer than SOFT_MIN_SUBSTEPS.
+  SOLVER_SOFT,
+  PHYSICS_SOLVERS
+};
+
+const char *const TABLE_solver_name[PHYSICS_SOLVERS] = {"impulse", "soft"};
+
+struct physics_params {
+  physics_solver solver;
+  int substeps;     // Fewest physics_steps per tick
+  int max_substeps; // Most, for fast or deeply overlapping scenes
+  int iterations;   // Velocity solver iterations per step
+
+  // Container size, centred on x = y = 0 with the floor at z = 0.
+  // The top is open, the walls go on up forever.
+  vec3 box;
+
+  // Touching bodies that share an id below this are reported by
+  // physics_step, for the game to merge
+  u32 merge_ids;
+};
+
+void container_planes(vec3 box, container_plane *planes);
+
 #define PHYSICS_SLOP (1e-3)
+// How much of the overlap the impulse solver's position solve takes out
+#define POSITION_CORRECTION 0.2f
+
+// The soft solver's contact springs, as stiff as a step can solve, a quarter
+// of the step rate, up to SOFT_CONTACT_HERTZ. So more substeps also means
+// less overlap. Overlap is pushed out no faster than SOFT_MAX_PUSH_SPEED.
+#define SOFT_CONTACT_HERTZ    120.0f
+#define SOFT_CONTACT_DAMPING  10.0f
+#define SOFT_MAX_PUSH_SPEED   3.0f
+#define SOFT_RELAX_ITERATIONS 2
+#define SOFT_MIN_SUBSTEPS     2
+
+// Islands sleep once every body in them has been under both speeds, on
+// average, for SLEEP_TIME seconds. Bodies touching anything lose spin at
+// REST_ANGULAR_DAMPING per second.
+#define SLEEP_LINEAR_SPEED   0.05f
+#define SLEEP_ANGULAR_SPEED  0.2f
+#define SLEEP_TIME           0.5f
+#define REST_ANGULAR_DAMPING 2.0f
+
+#define BROADPHASE_MAX_PAIRS_PER_BODY 32
+
+// What a step left behind, for picking the next tick's substeps
+struct physics_step_stats {
+  float max_speed;       // Fastest awake body
+  float max_penetration; // Deepest contact, before it was solved
+  iZ dropped_pairs;      // Overlaps the broadphase had no room for
+};
+
+// Bodies that would move further than CCD_MIN_TRAVEL times their smallest
+// radius in one step are stopped at whatever they'd hit first
+#define CCD_MIN_TRAVEL 0.25f
+
+// Enough substeps that no body moves further than SUBSTEP_MAX_TRAVEL in one.
+// On top of that they go up one a tick while contacts are deeper than
+// SUBSTEP_MAX_PENETRATION, and back down one a tick once they're under half
+// of it. Fast bodies stop at their first contact, so travel can be more than
+// the smallest fruit's radius, penetration has to stay well under it.
+// Kept within physics_params' range, and at least SOFT_MIN_SUBSTEPS for the
+// soft solver whatever that says.
+#define SUBSTEP_MAX_TRAVEL      0.16f
+#define SUBSTEP_MAX_PENETRATION 0.01f
+
+// Substeps for a tick of length dt, given how the last tick went
+int choose_substeps(const physics_params *, physics_step_stats last,
+                    int last_substeps, float dt);
+
+array<body_pair> broadphase_pairs(collision_body *, iZ num_bodies, vec3 box,
+                                  arena *, iZ *num_dropped = nullptr);
+
+// Touching pairs of the same type, gathered over a tick's steps
+struct merge_queue {
+  array<body_pair> pairs;
+  u8 *queued; // Per body, set once it's in a pair
+};
 
-void physics_step(fruit_body *, body_dynamics *, iZ num_bodies, float dt);
+// Pairs that could merge are pushed to merges, if it's given, unless either
+// body is already queued. Each body is in at most one pair, so half the
+// store always fits however many steps a pair stays in contact for.
+physics_step_stats physics_step(body_store *, array<cached_contact> *,
+                                const physics_params *, job_pool *, float dt,
+                                merge_queue *merges, arena *mem_temp);
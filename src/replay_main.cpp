@@ -0,0 +1,104 @@
+#include "types.h"
+
+#include <chrono>
+
+#include "input_log.cpp"
+#include "jobs.cpp"
+#include "melongame.cpp"
+#include "physics.cpp"
+#include "trace.cpp"
+
+// Replays an input log recorded with --record, headless and as fast as it
+// goes, then checks the game ended up where the recording did.
+//   replay <log> [--per-tick]
+// Prints key=value lines, one per tick with --per-tick, then a summary.
+// Exits with 1 if the final state doesn't match. The first tick that took
+// different substeps to the recording is where it started to go wrong.
+
+u64 replay_now_ns() {
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+int replay_compare_u64(const void *a, const void *b) {
+  u64 x = *(const u64 *)a;
+  u64 y = *(const u64 *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    puts("usage: replay <log> [--per-tick]");
+    return 2;
+  }
+  bool per_tick = argc > 2 && !strcmp(argv[2], "--per-tick");
+
+  arena program_memory = new_arena(ARENA_RESERVE(16_GB, 256_MB), "program");
+
+  input_log log;
+  if (!load_input_log(&log, argv[1], &program_memory)) {
+    return 2;
+  }
+  if (log.truncated) {
+    puts("Log was truncated while recording, the checksum won't match");
+  }
+
+  melon_state game{};
+  melon_init(&game, &program_memory, log.physics.solver);
+  game.physics.substeps = log.physics.substeps;
+  game.physics.max_substeps = log.physics.max_substeps;
+  game.physics.iterations = log.physics.iterations;
+
+  u64 *tick_ns = arena_push<u64>(&program_memory, (iZ)log.num_ticks + 1);
+  input_event *next = log.events.base;
+  const substep_run *run = log.substeps.base;
+  i64 first_diverged = -1;
+  for (u64 t = 0; t < log.num_ticks; ++t) {
+    arena frame = program_memory;
+
+    u64 t0 = replay_now_ns();
+    for (; next < log.events.tail && next->tick == t; ++next) {
+      melon_apply_input(&game, next->type);
+    }
+    renderer_input ri;
+    melon_tick(&game, &ri, &frame);
+    tick_ns[t] = replay_now_ns() - t0;
+
+    int recorded = input_log_substeps(&log, t, &run);
+    if (first_diverged < 0 && recorded != ri.substeps) {
+      first_diverged = (i64)t;
+    }
+    if (per_tick) {
+      printf("tick n=%llu us=%.1f bodies=%td awake=%td substeps=%d "
+             "recorded_substeps=%d\n",
+             (unsigned long long)t, tick_ns[t] / 1e3, ri.num_fruit,
+             ri.num_awake, ri.substeps, recorded);
+    }
+  }
+  // Input after the last tick still counts towards the final state
+  for (; next < log.events.tail; ++next) {
+    melon_apply_input(&game, next->type);
+  }
+
+  u64 total = 0;
+  for (u64 t = 0; t < log.num_ticks; ++t) {
+    total += tick_ns[t];
+  }
+  iZ n = (iZ)log.num_ticks;
+  qsort(tick_ns, (uZ)n, sizeof(u64), replay_compare_u64);
+
+  u64 checksum = body_store_checksum(&game.bodies);
+  bool match = checksum == log.checksum;
+  printf("replay ticks=%td events=%td bodies=%td total_ms=%.1f p50_us=%.1f "
+         "p99_us=%.1f max_us=%.1f first_diverged=%lld solver=%s "
+         "checksum=%016llx expected=%016llx match=%d\n",
+         n, log.events.size(), game.bodies.num, total / 1e6,
+         n ? tick_ns[n / 2] / 1e3 : 0.0, n ? tick_ns[n * 99 / 100] / 1e3 : 0.0,
+         n ? tick_ns[n - 1] / 1e3 : 0.0, (long long)first_diverged,
+         TABLE_solver_name[log.physics.solver],
+         (unsigned long long)checksum,
+         (unsigned long long)log.checksum, match);
+
+  free_job_pool(game.jobs);
+  return match ? 0 : 1;
+}
@@ -5,17 +5,77 @@
 #include <emscripten.h>
 #endif
 
+#include "fruit_instance.cpp"
+#include "input_log.cpp"
+#include "jobs.cpp"
 #include "melongame.cpp"
 #include "physics.cpp"
 #include "sdlgl_platform.cpp"
+#include "sim_thread.cpp"
+#include "trace.cpp"
 
 void main_loop(void *args) { sdlgl_loop((sdlgl_state *)args); }
 
 int main(int argv, char **args) {
-  arena program_memory = new_arena(16_MB);
+  arena program_memory = new_arena(ARENA_RESERVE(1_GB, 16_MB), "program");
+
+  // --solver <impulse|soft> picks how contacts are solved, for the whole run
+  // --headless <frames> draws that many offscreen, with no window or vsync,
+  //   then prints frames per second and quits (native Linux only)
+  physics_solver solver = SOLVER_IMPULSE;
+  bool headless = false;
+  u64 headless_frames = 0;
+  for (int i = 1; i + 1 < argv; ++i) {
+    if (!strcmp(args[i], "--solver")) {
+      int k = 0;
+      while (k < PHYSICS_SOLVERS && strcmp(args[i + 1], TABLE_solver_name[k])) {
+        ++k;
+      }
+      if (k == PHYSICS_SOLVERS) {
+        printf("No solver %s\n", args[i + 1]);
+        exit(1);
+      }
+      solver = (physics_solver)k;
+    }
+    if (!strcmp(args[i], "--headless")) {
+      headless = true;
+      headless_frames = strtoull(args[i + 1], nullptr, 10);
+    }
+  }
 
   sdlgl_state sdlgl_stuff;
-  sdlgl_init(&sdlgl_stuff, 900, 600, program_memory);
+  sdlgl_init(&sdlgl_stuff, 900, 600, program_memory, solver, headless);
+
+  // --record <path> saves the session's input, for build/replay
+  // --outline <inflated|screen> picks how outlines are drawn (O switches)
+  // --outline-compare switches every few seconds, printing GPU times
+  // --trace <path> writes a Chrome trace there on quit (T writes one anytime)
+  // --fruit <n> drops n fruit in to start with, which --record misses
+  // --dump <dir> writes every headless frame into dir, which has to exist
+  const char *dump_dir = nullptr;
+  for (int i = 1; i < argv; ++i) {
+    if (!strcmp(args[i], "--record") && i + 1 < argv) {
+      sdlgl_start_recording(&sdlgl_stuff, args[i + 1]);
+    }
+    if (!strcmp(args[i], "--outline") && i + 1 < argv) {
+      sdlgl_set_outline(&sdlgl_stuff, args[i + 1]);
+    }
+    if (!strcmp(args[i], "--outline-compare")) {
+      sdlgl_stuff.outline_compare = true;
+    }
+    if (!strcmp(args[i], "--trace") && i + 1 < argv) {
+      sdlgl_set_trace(&sdlgl_stuff, args[i + 1]);
+    }
+    if (!strcmp(args[i], "--fruit") && i + 1 < argv) {
+      sdlgl_add_fruit(&sdlgl_stuff, atoi(args[i + 1]));
+    }
+    if (!strcmp(args[i], "--dump") && i + 1 < argv) {
+      dump_dir = args[i + 1];
+    }
+  }
+  if (headless) {
+    sdlgl_set_headless_run(&sdlgl_stuff, headless_frames, dump_dir);
+  }
 
 #ifdef BUILD_WASM
   emscripten_set_main_loop_arg(main_loop, (void *)&sdlgl_stuff, 0, true);
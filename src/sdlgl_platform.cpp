@@ -54,47 +54,47 @@ void make_UV_sphere_mesh_verts(iZ ndivs_u, iZ ndivs_v, vec3 *verts,
   *verts++ = {0.0f, 0.0f, vcos[ndivs_v + 1]};
 }
 
-void make_UV_sphere_tris(iZ ndivs_u, iZ ndivs_v, vec3 *tris, arena *mem_temp) {
-  arena scratch = *mem_temp;
+// Indices into make_UV_sphere_mesh_verts' verts, offset by first_vert
+void make_UV_sphere_indices(iZ ndivs_u, iZ ndivs_v, u16 first_vert,
+                            u16 *indices) {
   // TODO - Triangle strips? Not worth the effort?
-
-  int num_verts = 2 + ndivs_u * ndivs_v;
-  vec3 *verts = arena_push<vec3>(&scratch, num_verts);
-  make_UV_sphere_mesh_verts(ndivs_u, ndivs_v, verts, &scratch);
+  iZ num_verts = 2 + ndivs_u * ndivs_v;
+  ASSERT(first_vert + num_verts <= 1 << 16);
+  auto index = [&](iZ v) { *indices++ = (u16)(first_vert + v); };
 
   // Top fan
-  for (int u = 0; u < ndivs_u; ++u) {
-    int i0 = 1;
-    *tris++ = verts[0];
-    *tris++ = verts[i0 + (u + 1) % ndivs_u];
-    *tris++ = verts[i0 + u];
+  for (iZ u = 0; u < ndivs_u; ++u) {
+    iZ i0 = 1;
+    index(0);
+    index(i0 + (u + 1) % ndivs_u);
+    index(i0 + u);
   }
 
   // Strips
-  for (int v = 0; v < ndivs_v - 1; ++v) {
-    for (int u = 0; u < ndivs_u; ++u) {
-      int u0 = 1 + v * ndivs_u;
-      int u1 = 1 + (v + 1) * ndivs_u;
-
-      int c0 = u0 + u;
-      int c1 = u0 + (u + 1) % ndivs_u;
-      int c2 = u1 + u;
-      int c3 = u1 + (u + 1) % ndivs_u;
-      *tris++ = verts[c0];
-      *tris++ = verts[c1];
-      *tris++ = verts[c2];
-      *tris++ = verts[c2];
-      *tris++ = verts[c1];
-      *tris++ = verts[c3];
+  for (iZ v = 0; v < ndivs_v - 1; ++v) {
+    for (iZ u = 0; u < ndivs_u; ++u) {
+      iZ u0 = 1 + v * ndivs_u;
+      iZ u1 = 1 + (v + 1) * ndivs_u;
+
+      iZ c0 = u0 + u;
+      iZ c1 = u0 + (u + 1) % ndivs_u;
+      iZ c2 = u1 + u;
+      iZ c3 = u1 + (u + 1) % ndivs_u;
+      index(c0);
+      index(c1);
+      index(c2);
+      index(c2);
+      index(c1);
+      index(c3);
     }
   }
 
   // Bot fan
-  for (int u = 0; u < ndivs_u; ++u) {
-    int i0 = num_verts - 1 - ndivs_u;
-    *tris++ = verts[i0 + u];
-    *tris++ = verts[i0 + ((u + 1) % ndivs_u)];
-    *tris++ = verts[num_verts - 1];
+  for (iZ u = 0; u < ndivs_u; ++u) {
+    iZ i0 = num_verts - 1 - ndivs_u;
+    index(i0 + u);
+    index(i0 + ((u + 1) % ndivs_u));
+    index(num_verts - 1);
   }
 }
 
@@ -197,81 +197,574 @@ GLuint compile_shader(const char *vertex_shader, const char *fragment_shader) {
   return ID;
 }
 
-void upload_fruit_instances(sdlgl_state *s, fruit_body *f, int num_fruit) {
-  glBindBuffer(GL_ARRAY_BUFFER, s->vbo_fruit_instances);
-  glBufferData(GL_ARRAY_BUFFER, num_fruit * (iZ)sizeof(fruit_body), f,
-               GL_STATIC_DRAW);
+mat4 camera_proj_view(sdlgl_state *s) {
+  mat4 proj_mat = glm::perspective(glm::radians(SDLGL_FOV_Y),
+                                   (float)s->width / (float)s->height, 0.1f,
+                                   1000.0f);
+  mat4 view_mat = glm::lookAt(s->camera_pos, vec3(0, 0, 1), vec3(0, 0, 1));
+  return proj_mat * view_mat;
 }
 
-void draw_fruit(sdlgl_state *s, int num_fruit) {
-  mat4 proj_mat = glm::perspective(
-      glm::radians(69.0f), (float)s->width / (float)s->height, 0.1f, 1000.0f);
-  mat4 view_mat = glm::lookAt(s->camera_pos, vec3(0, 0, 1), vec3(0, 0, 1));
+// Instance attributes of the bound VAO, starting from first_instance of
+// what's bound to GL_ARRAY_BUFFER
+void point_fruit_instance_attribs(iZ first_instance) {
+  GLsizei stride = sizeof(fruit_instance);
+  uZ base = (uZ)first_instance * sizeof(fruit_instance);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+                        (void *)(base + offsetof(fruit_instance, position)));
+  glVertexAttribPointer(
+      2, 4, GL_UNSIGNED_INT_2_10_10_10_REV, GL_FALSE, stride,
+      (void *)(base + offsetof(fruit_instance, orientation)));
+  glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE, stride,
+                         (void *)(base + offsetof(fruit_instance, id)));
+}
 
-  mat4 pv = proj_mat * view_mat;
+/*     ======  Render commands ======
+ * See sdlgl_platform.h. Every call the cache saves is counted as skipped,
+ * so calls + skipped is what the same commands cost without it.
+ */
 
-  glUseProgram(s->prog_fruit);
-  GLint loc_pvm = glGetUniformLocation(s->prog_fruit, "pv");
-  glUniformMatrix4fv(loc_pvm, 1, GL_FALSE, glm::value_ptr(pv));
+void render_push(array<render_cmd> *cmds, render_cmd cmd) {
+  ASSERT(!cmds->isfull());
+  cmds->push(cmd);
+}
 
-  glBindVertexArray(s->vao_fruit);
-  glBindBuffer(GL_ARRAY_BUFFER, s->vbo_fruit_instances);
-  glBindBuffer(GL_ARRAY_BUFFER, s->vbo_sphere);
-  glEnable(GL_DEPTH_TEST);
-  glDisable(GL_BLEND);
-  glEnable(GL_CULL_FACE);
-  GLint loc_outline = glGetUniformLocation(s->prog_fruit, "outline");
+u32 uniform_bits(float f) {
+  u32 bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
 
-  glUniform1f(loc_outline, 1);
-  glFrontFace(GL_CW);
-  glDrawArraysInstanced(GL_TRIANGLES, 0, s->sphere_num_verts, num_fruit);
+// Calls set(value) unless *current is already value
+template <class T, class F>
+void gl_cached(gl_state_cache *gl, T *current, T value, F set) {
+  if (*current == value) {
+    gl->skipped++;
+    return;
+  }
+  *current = value;
+  gl->calls++;
+  set(value);
+}
 
-  glUniform1f(loc_outline, 0);
-  glFrontFace(GL_CCW);
-  glDrawArraysInstanced(GL_TRIANGLES, 0, s->sphere_num_verts, num_fruit);
+void gl_capability(gl_state_cache *gl, bool *current, bool want, GLenum cap) {
+  gl_cached(gl, current, want, [&](bool on) {
+    if (on) {
+      glEnable(cap);
+    } else {
+      glDisable(cap);
+    }
+  });
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+void gl_bind_buffer(gl_state_cache *gl, GLenum target, GLuint buffer) {
+  GLuint *bound = &gl->buffers[target == GL_UNIFORM_BUFFER];
+  gl_cached(gl, bound, buffer, [&](GLuint b) { glBindBuffer(target, b); });
 }
 
-void draw_box(sdlgl_state *s) {
-  mat4 proj_mat = glm::perspective(
-      glm::radians(69.0f), (float)s->width / (float)s->height, 0.1f, 1000.0f);
-  mat4 view_mat = glm::lookAt(s->camera_pos, vec3(0, 0, 1), vec3(0, 0, 1));
-  mat4 vt = glm::translate(mat4(1.0f), vec3(0, 0, 1));
+void gl_uniform(gl_state_cache *gl, render_cmd_type type, GLint location,
+                u32 bits) {
+  auto set = [&](u32 b) {
+    if (type == RENDER_UNIFORM_1F) {
+      float f;
+      memcpy(&f, &b, sizeof(f));
+      glUniform1f(location, f);
+    } else {
+      glUniform1ui(location, b);
+    }
+  };
+  for (int i = 0; i < gl->num_uniforms; ++i) {
+    if (gl->uniforms[i].program == gl->program &&
+        gl->uniforms[i].location == location) {
+      gl_cached(gl, &gl->uniforms[i].bits, bits, set);
+      return;
+    }
+  }
+  if (gl->num_uniforms < RENDER_CACHED_UNIFORMS) {
+    gl->uniforms[gl->num_uniforms++] = {gl->program, location, bits};
+  }
+  gl->calls++;
+  set(bits);
+}
 
-  mat4 model_mat = glm::mat4(1.0f);
+// What the context is left with at the end of sdlgl_init
+gl_state_cache new_gl_state_cache() {
+  gl_state_cache gl{};
+  gl.state = {.depth_test = false,
+              .blend = false,
+              .cull_face = false,
+              .front_face = GL_CCW,
+              .depth_func = GL_LESS};
+  return gl;
+}
 
-  mat4 pvm = proj_mat * view_mat * vt * model_mat;
+// Plays cmds back in order, leaving out whatever's already set
+void render_submit(sdlgl_state *s, const array<render_cmd> *cmds) {
+  TRACE_SCOPE("submit");
+  gl_state_cache *gl = &s->gl;
+  for (const render_cmd *cmd = cmds->base; cmd != cmds->tail; ++cmd) {
+    switch (cmd->type) {
+    case RENDER_FRAMEBUFFER: {
+      gl_cached(gl, &gl->framebuffer, cmd->object, [](GLuint fbo) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+      });
+    } break;
+    case RENDER_CLEAR: {
+      gl->calls++;
+      glClear(cmd->clear_mask);
+    } break;
+    case RENDER_CLEAR_SCENE: {
+      GLuint no_fruit[4] = {0, 0, 0, 0};
+      GLfloat far_depth = 1.0f;
+      gl->calls += 3;
+      glClearBufferfv(GL_COLOR, 0, s->clear_colour);
+      glClearBufferuiv(GL_COLOR, 1, no_fruit);
+      glClearBufferfv(GL_DEPTH, 0, &far_depth);
+    } break;
+    case RENDER_STATE: {
+      const render_state &want = cmd->state;
+      gl_capability(gl, &gl->state.depth_test, want.depth_test,
+                    GL_DEPTH_TEST);
+      gl_capability(gl, &gl->state.blend, want.blend, GL_BLEND);
+      gl_capability(gl, &gl->state.cull_face, want.cull_face, GL_CULL_FACE);
+      gl_cached(gl, &gl->state.front_face, want.front_face, glFrontFace);
+      gl_cached(gl, &gl->state.depth_func, want.depth_func, glDepthFunc);
+    } break;
+    case RENDER_PROGRAM: {
+      gl_cached(gl, &gl->program, cmd->object, glUseProgram);
+    } break;
+    case RENDER_VAO: {
+      gl_cached(gl, &gl->vao, cmd->object, glBindVertexArray);
+    } break;
+    case RENDER_TEXTURE: {
+      GLuint unit = cmd->texture.unit;
+      ASSERT(unit < RENDER_TEXTURE_UNITS);
+      if (gl->textures[unit] == cmd->texture.texture) {
+        gl->skipped += 2;
+        break;
+      }
+      gl_cached(gl, &gl->active_texture, unit,
+                [](GLuint u) { glActiveTexture(GL_TEXTURE0 + u); });
+      gl_cached(gl, &gl->textures[unit], cmd->texture.texture,
+                [](GLuint t) { glBindTexture(GL_TEXTURE_2D, t); });
+    } break;
+    case RENDER_UNIFORM_1F:
+    case RENDER_UNIFORM_1UI: {
+      gl_uniform(gl, cmd->type, cmd->uniform.location, cmd->uniform.bits);
+    } break;
+    case RENDER_BUFFER_DATA: {
+      gl_bind_buffer(gl, cmd->buffer_data.target, cmd->buffer_data.buffer);
+      gl->calls++;
+      glBufferSubData(cmd->buffer_data.target, cmd->buffer_data.offset,
+                      cmd->buffer_data.size, cmd->buffer_data.data);
+    } break;
+    case RENDER_INSTANCE_ATTRIBS: {
+      gl_bind_buffer(gl, GL_ARRAY_BUFFER, cmd->instance_attribs.buffer);
+      gl->calls += 3;
+      point_fruit_instance_attribs(cmd->instance_attribs.first);
+    } break;
+    case RENDER_DRAW_ARRAYS: {
+      TRACE_SCOPE("draw arrays");
+      gl->calls++;
+      glDrawArrays(GL_TRIANGLES, cmd->draw_arrays.first,
+                   cmd->draw_arrays.count);
+    } break;
+    case RENDER_DRAW_INSTANCED: {
+      TRACE_SCOPE("draw instanced");
+      gl->calls++;
+      glDrawElementsInstanced(GL_TRIANGLES, cmd->draw_instanced.count,
+                              GL_UNSIGNED_SHORT,
+                              (void *)cmd->draw_instanced.offset,
+                              cmd->draw_instanced.instances);
+    } break;
+    case RENDER_QUERY_BEGIN: {
+      gl->calls++;
+      glBeginQuery(GL_TIME_ELAPSED_EXT, cmd->object);
+    } break;
+    case RENDER_QUERY_END: {
+      gl->calls++;
+      glEndQuery(GL_TIME_ELAPSED_EXT);
+    } break;
+    }
+  }
+}
 
-  glUseProgram(s->prog_box);
-  GLint loc_pvm = glGetUniformLocation(s->prog_box, "pvm");
-  glUniformMatrix4fv(loc_pvm, 1, GL_FALSE, glm::value_ptr(pvm));
+// This frame's camera, for culling here and for every pass through
+// ubo_camera
+void record_camera(sdlgl_state *s, array<render_cmd> *cmds, arena *mem) {
+  s->proj_view = camera_proj_view(s);
+  camera_block *block = arena_push<camera_block>(mem, 1);
+  block->proj_view = s->proj_view;
+  render_push(cmds, {.type = RENDER_BUFFER_DATA,
+                     .buffer_data = {.target = GL_UNIFORM_BUFFER,
+                                     .buffer = s->ubo_camera,
+                                     .offset = 0,
+                                     .size = sizeof(camera_block),
+                                     .data = block}});
+}
 
-  glBindVertexArray(s->vao_box);
-  glBindBuffer(GL_ARRAY_BUFFER, s->vbo_box);
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glDisable(GL_CULL_FACE);
-  glDrawArrays(GL_TRIANGLES, 0, s->box_num_verts);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+// Packs the fruit that moved, works out what's on screen at which LOD, then
+// brings the next buffer in the ring up to date with that
+void upload_fruit_instances(sdlgl_state *s, renderer_input *ri,
+                            array<render_cmd> *cmds, arena *mem_temp) {
+  TRACE_SCOPE("upload");
+  iZ num = ri->num_fruit;
+  pack_fruit_instances(ri->fruit, ri->moved, num, s->instances);
+  for (iZ i = 0; i < num; ++i) {
+    s->instance_version[i] += ri->moved[i];
+  }
+
+  fruit_view view;
+  view.proj_view = s->proj_view;
+  view.camera_pos = s->camera_pos;
+  view.pixel_scale =
+      (float)s->height / (2.0f * tanf(glm::radians(SDLGL_FOV_Y) / 2.0f));
+  build_fruit_draw_list(&s->draw_list, s->instances, num, &view, mem_temp);
+
+  s->instance_buffer = (s->instance_buffer + 1) % SDLGL_INSTANCE_BUFFERS;
+  int k = s->instance_buffer;
+  u16 *slot_fruit = s->buffer_slot_fruit[k];
+  u32 *slot_version = s->buffer_slot_version[k];
+  const u16 *wanted = s->draw_list.slot_fruit;
+  iZ num_slots = s->draw_list.lod_start[FRUIT_LODS];
+
+  // Slots to send, marked by bringing their fruit and version up to date
+  // as they're found
+  auto stale = [&](iZ slot) {
+    u16 f = wanted[slot];
+    bool result = slot_fruit[slot] != f ||
+                  slot_version[slot] != s->instance_version[f];
+    slot_fruit[slot] = f;
+    slot_version[slot] = s->instance_version[f];
+    return result;
+  };
+
+  // Lives in the frame arena until the commands are submitted
+  fruit_instance *staging = arena_push<fruit_instance>(mem_temp, num_slots);
+  iZ i = 0;
+  while (i < num_slots) {
+    if (!stale(i)) {
+      ++i;
+      continue;
+    }
+    iZ first = i;
+    iZ last = i;
+    for (++i; i < num_slots && i - last <= SDLGL_UPLOAD_MERGE_GAP; ++i) {
+      if (stale(i)) {
+        last = i;
+      }
+    }
+    i = last + 1;
+    for (iZ slot = first; slot <= last; ++slot) {
+      staging[slot] = s->instances[wanted[slot]];
+    }
+    render_push(cmds,
+                {.type = RENDER_BUFFER_DATA,
+                 .buffer_data = {
+                     .target = GL_ARRAY_BUFFER,
+                     .buffer = s->vbo_fruit_instances[k],
+                     .offset = first * (iZ)sizeof(fruit_instance),
+                     .size = (last + 1 - first) * (iZ)sizeof(fruit_instance),
+                     .data = staging + first}});
+  }
+}
+
+// Finds the edges in what draw_fruit left in fbo_scene and draws the result
+// to the screen, depth included so the box still goes behind and in front
+void draw_screen_outlines(sdlgl_state *s, array<render_cmd> *cmds) {
+  TRACE_SCOPE("record outlines");
+  render_push(cmds, {.type = RENDER_FRAMEBUFFER, .object = s->fbo_target});
+  render_push(cmds, {.type = RENDER_STATE,
+                     .state = {.depth_test = true,
+                               .blend = false,
+                               .cull_face = false,
+                               .front_face = GL_CCW,
+                               .depth_func = GL_ALWAYS}});
+  render_push(cmds, {.type = RENDER_PROGRAM, .object = s->prog_outline});
+  GLuint textures[3] = {s->tex_scene_colour, s->tex_scene_fruit,
+                        s->tex_scene_depth};
+  for (GLuint unit = 0; unit < 3; ++unit) {
+    render_push(cmds, {.type = RENDER_TEXTURE,
+                       .texture = {.unit = unit, .texture = textures[unit]}});
+  }
+  render_push(cmds, {.type = RENDER_VAO, .object = s->vao_outline});
+  render_push(cmds, {.type = RENDER_DRAW_ARRAYS,
+                     .draw_arrays = {.first = 0, .count = 3}});
+}
+
+void draw_fruit(sdlgl_state *s, array<render_cmd> *cmds) {
+  TRACE_SCOPE("record fruit");
+  bool screen_outline = s->outline == OUTLINE_SCREEN;
+
+  if (screen_outline) {
+    render_push(cmds, {.type = RENDER_FRAMEBUFFER, .object = s->fbo_scene});
+    render_push(cmds, {.type = RENDER_CLEAR_SCENE});
+  }
+
+  render_push(cmds, {.type = RENDER_PROGRAM, .object = s->prog_fruit});
+  render_push(cmds, {.type = RENDER_VAO,
+                     .object = s->vao_fruit[s->instance_buffer]});
+
+  s->frame_tris = s->frame_verts = 0;
+  for (int outline = screen_outline ? 0 : 1; outline >= 0; --outline) {
+    // Outlines are the back faces
+    GLenum front_face = outline ? GL_CW : GL_CCW;
+    render_push(cmds, {.type = RENDER_STATE,
+                       .state = {.depth_test = true,
+                                 .blend = false,
+                                 .cull_face = true,
+                                 .front_face = front_face,
+                                 .depth_func = GL_LESS}});
+    render_push(cmds, {.type = RENDER_UNIFORM_1F,
+                       .uniform = {.location = s->loc_fruit_outline,
+                                   .bits = uniform_bits((float)outline)}});
+    for (int lod = 0; lod < FRUIT_LODS; ++lod) {
+      iZ first = s->draw_list.lod_start[lod];
+      iZ count = s->draw_list.lod_start[lod + 1] - first;
+      if (count == 0) {
+        continue;
+      }
+      render_push(
+          cmds,
+          {.type = RENDER_INSTANCE_ATTRIBS,
+           .instance_attribs = {
+               .buffer = s->vbo_fruit_instances[s->instance_buffer],
+               .first = first}});
+      if (screen_outline) {
+        // Only read back for screen space outlines
+        render_push(cmds, {.type = RENDER_UNIFORM_1UI,
+                           .uniform = {.location = s->loc_fruit_first_slot,
+                                       .bits = (u32)first}});
+      }
+      render_push(cmds,
+                  {.type = RENDER_DRAW_INSTANCED,
+                   .draw_instanced = {
+                       .count = s->sphere_lod_indices[lod],
+                       .offset = s->sphere_lod_offset[lod],
+                       .instances = (GLsizei)count}});
+      s->frame_tris += count * fruit_lod_tris(lod);
+      s->frame_verts += count * fruit_lod_verts(lod);
+    }
+  }
+
+  if (screen_outline) {
+    draw_screen_outlines(s, cmds);
+  }
+}
+
+/*     ======  GPU timing ======
+ * Time elapsed queries around draw_fruit, from GL_EXT_disjoint_timer_query.
+ * Results are picked up SDLGL_TIMER_QUERIES frames later so nothing waits on
+ * the GPU, and frames whose query still isn't done go untimed.
+ */
+
+void gpu_timer_begin(sdlgl_state *s, array<render_cmd> *cmds) {
+  if (!s->has_timer_query) {
+    return;
+  }
+  int k = s->next_timer_query;
+  if (s->timer_query_pending[k]) {
+    GLuint available = 0;
+    s->gl.calls++;
+    glGetQueryObjectuiv(s->timer_queries[k], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+    if (!available) {
+      return;
+    }
+    GLuint ns = 0;
+    glGetQueryObjectuiv(s->timer_queries[k], GL_QUERY_RESULT, &ns);
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    s->gl.calls += 2;
+    if (!disjoint) {
+      s->gpu_ns[s->timer_query_outline[k]] += ns;
+      s->gpu_frames[s->timer_query_outline[k]]++;
+    }
+    s->timer_query_pending[k] = false;
+  }
+
+  render_push(cmds,
+              {.type = RENDER_QUERY_BEGIN, .object = s->timer_queries[k]});
+  s->timer_query_outline[k] = s->outline;
+  s->timer_query_pending[k] = true;
+  s->timer_running = true;
+}
+
+void gpu_timer_end(sdlgl_state *s, array<render_cmd> *cmds) {
+  if (!s->timer_running) {
+    return;
+  }
+  render_push(cmds, {.type = RENDER_QUERY_END});
+  s->next_timer_query = (s->next_timer_query + 1) % SDLGL_TIMER_QUERIES;
+  s->timer_running = false;
+}
+
+// Averages per frame for each outline mode used since the last report, GPU
+// time where there's a timer
+void report_gpu_times(sdlgl_state *s) {
+  for (int mode = 0; mode < OUTLINE_MODES; ++mode) {
+    if (s->gl_frames[mode]) {
+      printf("outline mode=%s frames=%d gl_calls=%.1f gl_skipped=%.1f",
+             TABLE_outline_name[mode], s->gl_frames[mode],
+             (double)s->gl_calls[mode] / s->gl_frames[mode],
+             (double)s->gl_skipped[mode] / s->gl_frames[mode]);
+      if (s->gpu_frames[mode]) {
+        printf(" gpu_us=%.1f",
+               (double)s->gpu_ns[mode] / s->gpu_frames[mode] / 1e3);
+      }
+      if (s->wall_frames[mode]) {
+        printf(" wall_ms=%.2f",
+               (double)s->wall_ns[mode] / s->wall_frames[mode] / 1e6);
+      }
+      printf("\n");
+    }
+    s->gpu_ns[mode] = 0;
+    s->gpu_frames[mode] = 0;
+    s->gl_calls[mode] = s->gl_skipped[mode] = 0;
+    s->gl_frames[mode] = 0;
+    s->wall_ns[mode] = 0;
+    s->wall_frames[mode] = 0;
+  }
+  fflush(stdout);
+}
+
+void draw_box(sdlgl_state *s, array<render_cmd> *cmds) {
+  TRACE_SCOPE("record box");
+  render_push(cmds, {.type = RENDER_STATE,
+                     .state = {.depth_test = true,
+                               .blend = true,
+                               .cull_face = false,
+                               .front_face = GL_CCW,
+                               .depth_func = GL_LESS}});
+  render_push(cmds, {.type = RENDER_PROGRAM, .object = s->prog_box});
+  render_push(cmds, {.type = RENDER_VAO, .object = s->vao_box});
+  render_push(cmds, {.type = RENDER_DRAW_ARRAYS,
+                     .draw_arrays = {.first = 0, .count = s->box_num_verts}});
 }
 
-void sdlgl_init(sdlgl_state *s, int width, int height, arena memory) {
-  if (SDL_Init(SDL_INIT_VIDEO)) {
-    printf("SDL could not initialize! SDL_Error:%s\n", SDL_GetError());
-    ASSERT(0);
+/*     ======  Headless ======
+ * A GLES 3.0 context on Mesa's surfaceless platform, which needs no display
+ * server or GPU (llvmpipe draws when there isn't one). Without a surface
+ * there's no default framebuffer, so frames go to an offscreen one, and with
+ * nothing to swap there's no vsync either.
+ */
+
+// Whether name is in a space separated extension string
+bool has_extension(const char *extensions, const char *name) {
+  uZ len = strlen(name);
+  for (const char *p = extensions; p && (p = strstr(p, name)); p += len) {
+    bool starts = p == extensions || p[-1] == ' ';
+    if (starts && (p[len] == ' ' || p[len] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#if SDLGL_HEADLESS
+// Makes a context current with no surface, for s to tear down on quit
+void egl_init_surfaceless(sdlgl_state *s) {
+  const char *client_exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (!has_extension(client_exts, "EGL_MESA_platform_surfaceless")) {
+    puts("No EGL_MESA_platform_surfaceless, can't run headless");
+    exit(1);
   }
+  EGLDisplay display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                             EGL_DEFAULT_DISPLAY, nullptr);
+  EGLint majv, minv;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &majv, &minv)) {
+    printf("EGL could not initialize! EGL error:0x%x\n", eglGetError());
+    exit(1);
+  }
+  printf("EGL Version: %d.%d\n", majv, minv);
+  if (!has_extension(eglQueryString(display, EGL_EXTENSIONS),
+                     "EGL_KHR_surfaceless_context")) {
+    puts("No EGL_KHR_surfaceless_context, can't run headless");
+    exit(1);
+  }
+
+  // Never drawn through, so any surface type will do
+  EGLint config_attribs[] = {EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE,
+                             EGL_OPENGL_ES3_BIT, EGL_NONE};
+  EGLConfig config;
+  EGLint num_configs = 0;
+  eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+  EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3,
+                              EGL_CONTEXT_MINOR_VERSION, 0, EGL_NONE};
+  eglBindAPI(EGL_OPENGL_ES_API);
+  EGLContext context =
+      num_configs ? eglCreateContext(display, config, EGL_NO_CONTEXT,
+                                     context_attribs)
+                  : EGL_NO_CONTEXT;
+  if (context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    printf("No OpenGLES 3.0 context without a surface, EGL error:0x%x\n",
+           eglGetError());
+    exit(1);
+  }
+  printf("GL Renderer: %s\n", (const char *)glGetString(GL_RENDERER));
+
+  s->egl_display = display;
+  s->egl_context = context;
+}
+#endif
+
+// Writes what's in fbo_target to dump_dir as a binary PPM named by frame
+bool dump_frame(sdlgl_state *s, arena *mem_temp) {
+  TRACE_SCOPE("dump");
+  arena scratch = *mem_temp;
+  iZ w = s->width, h = s->height;
+  u8 *rgba = arena_push<u8>(&scratch, 4 * w * h);
+  u8 *row = arena_push<u8>(&scratch, 3 * w);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, s->fbo_target);
+  glReadPixels(0, 0, (GLsizei)w, (GLsizei)h, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/frame_%05llu.ppm", s->dump_dir,
+           (unsigned long long)s->frame);
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    printf("Couldn't open %s for the frame\n", path);
+    return false;
+  }
+  fprintf(f, "P6\n%td %td\n255\n", w, h);
+  // GL's rows go bottom up
+  for (iZ y = h - 1; y >= 0; --y) {
+    const u8 *src = rgba + 4 * w * y;
+    for (iZ x = 0; x < w; ++x) {
+      row[3 * x + 0] = src[4 * x + 0];
+      row[3 * x + 1] = src[4 * x + 1];
+      row[3 * x + 2] = src[4 * x + 2];
+    }
+    fwrite(row, 1, (uZ)(3 * w), f);
+  }
+  bool ok = !ferror(f);
+  ok &= fclose(f) == 0;
+  return ok;
+}
+
+void sdlgl_init(sdlgl_state *s, int width, int height, arena memory,
+                physics_solver solver, bool headless) {
   {
     SDL_version vers;
     SDL_GetVersion(&vers);
     printf("SDL Version: %d.%d.%d\n", vers.major, vers.minor, vers.patch);
   }
 
-  SDL_Window *window;
-  {
+  SDL_Window *window = nullptr;
+  if (headless) {
+#if SDLGL_HEADLESS
+    egl_init_surfaceless(s);
+#else
+    puts("Headless rendering needs a native Linux build");
+    exit(1);
+#endif
+  } else {
+    if (SDL_Init(SDL_INIT_VIDEO)) {
+      printf("SDL could not initialize! SDL_Error:%s\n", SDL_GetError());
+      ASSERT(0);
+    }
+
     int request_prof = SDL_GL_CONTEXT_PROFILE_ES;
     int request_majv = 3;
     int request_minv = 0;
@@ -296,9 +789,33 @@ void sdlgl_init(sdlgl_state *s, int width, int height, arena memory) {
       puts("Platform doesn't support requested OpenGLES version");
       ASSERT(0);
     }
+
+    SDL_GL_SetSwapInterval(1);
   }
 
-  SDL_GL_SetSwapInterval(1);
+  // Headless frames go here in place of the window's framebuffer
+  GLuint target_fbo = 0, target_rbos[2] = {0, 0};
+  if (headless) {
+    GLenum formats[2] = {GL_RGBA8, GL_DEPTH_COMPONENT24};
+    GLenum attachments[2] = {GL_COLOR_ATTACHMENT0, GL_DEPTH_ATTACHMENT};
+    glGenFramebuffers(1, &target_fbo);
+    glGenRenderbuffers(2, target_rbos);
+    glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+    for (int k = 0; k < 2; ++k) {
+      glBindRenderbuffer(GL_RENDERBUFFER, target_rbos[k]);
+      glRenderbufferStorage(GL_RENDERBUFFER, formats[k], width, height);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachments[k],
+                                GL_RENDERBUFFER, target_rbos[k]);
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      puts("Headless target framebuffer is incomplete");
+      exit(1);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Nothing sized the viewport, there was no surface to take it from
+    glViewport(0, 0, width, height);
+  }
 
   const char *fruit_vert_code =
 #include "../shaders/fruit.vert"
@@ -308,46 +825,74 @@ void sdlgl_init(sdlgl_state *s, int width, int height, arena memory) {
       ;
 
   GLuint fruit_program = compile_shader(fruit_vert_code, fruit_frag_code);
-  glUseProgram(fruit_program);
+  GLint loc_fruit_outline = glGetUniformLocation(fruit_program, "outline");
+  GLint loc_fruit_first_slot =
+      glGetUniformLocation(fruit_program, "first_slot");
+
+  // Every LOD's sphere, one after the other
+  GLuint sphere_mesh_vbo, sphere_mesh_ibo;
+  GLsizei sphere_lod_indices[FRUIT_LODS];
+  iZ sphere_lod_offset[FRUIT_LODS];
+  glGenBuffers(1, &sphere_mesh_vbo);
+  glGenBuffers(1, &sphere_mesh_ibo);
+  {
+    iZ num_verts = 0, num_indices = 0;
+    for (int lod = 0; lod < FRUIT_LODS; ++lod) {
+      num_verts += fruit_lod_verts(lod);
+      num_indices += 3 * fruit_lod_tris(lod);
+    }
+
+    arena scratch = memory;
+    vec3 *verts = arena_push<vec3>(&scratch, num_verts);
+    u16 *indices = arena_push<u16>(&scratch, num_indices);
+    iZ first_vert = 0, first_index = 0;
+    for (int lod = 0; lod < FRUIT_LODS; ++lod) {
+      const fruit_lod &l = TABLE_fruit_lod[lod];
+      make_UV_sphere_mesh_verts(l.ndivs_u, l.ndivs_v, verts + first_vert,
+                                &scratch);
+      make_UV_sphere_indices(l.ndivs_u, l.ndivs_v, (u16)first_vert,
+                             indices + first_index);
+      printf("Fruit LOD %d has %td tris, %td verts\n", lod,
+             fruit_lod_tris(lod), fruit_lod_verts(lod));
+
+      sphere_lod_indices[lod] = (GLsizei)(3 * fruit_lod_tris(lod));
+      sphere_lod_offset[lod] = first_index * (iZ)sizeof(u16);
+      first_vert += fruit_lod_verts(lod);
+      first_index += 3 * fruit_lod_tris(lod);
+    }
 
-  int ndu = 32, ndv = 16;
-  int sphere_num_tris = 2 * ndu * ndv;
+    glBindBuffer(GL_ARRAY_BUFFER, sphere_mesh_vbo);
+    glBufferData(GL_ARRAY_BUFFER, num_verts * (iZ)sizeof(vec3), verts,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphere_mesh_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * (iZ)sizeof(u16),
+                 indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
 
-  GLuint sphere_mesh_vao;
-  GLuint sphere_mesh_vbo, fruit_instance_vbo;
-  glGenVertexArrays(1, &sphere_mesh_vao);
-  glBindVertexArray(sphere_mesh_vao);
-  {
-    glGenBuffers(1, &sphere_mesh_vbo);
+  GLuint fruit_vaos[SDLGL_INSTANCE_BUFFERS];
+  GLuint fruit_instance_vbos[SDLGL_INSTANCE_BUFFERS];
+  glGenVertexArrays(SDLGL_INSTANCE_BUFFERS, fruit_vaos);
+  glGenBuffers(SDLGL_INSTANCE_BUFFERS, fruit_instance_vbos);
+  for (int k = 0; k < SDLGL_INSTANCE_BUFFERS; ++k) {
+    glBindVertexArray(fruit_vaos[k]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphere_mesh_ibo);
     glBindBuffer(GL_ARRAY_BUFFER, sphere_mesh_vbo);
     {
       glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)0);
       glEnableVertexAttribArray(0);
       glVertexAttribDivisor(0, 0);
     }
-    glGenBuffers(1, &fruit_instance_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, fruit_instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, fruit_instance_vbos[k]);
+    glBufferData(GL_ARRAY_BUFFER, MAX_FRUIT * (iZ)sizeof(fruit_instance),
+                 nullptr, GL_STREAM_DRAW);
     {
-      uZ pos_offset =
-          offsetof(fruit_body, body) + offsetof(rigidbody, position);
-      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(fruit_body),
-                            (void *)pos_offset);
-      glEnableVertexAttribArray(1);
-      glVertexAttribDivisor(1, 1);
-
-      uZ ori_offset =
-          offsetof(fruit_body, body) + offsetof(rigidbody, orientation);
-      for (u32 i = 0; i < 3; ++i) {
-        glVertexAttribPointer(2 + i, 3, GL_FLOAT, GL_FALSE, sizeof(fruit_body),
-                              (void *)(ori_offset + i * sizeof(vec3)));
-        glEnableVertexAttribArray(2 + i);
-        glVertexAttribDivisor(2 + i, 1);
+      point_fruit_instance_attribs(0);
+      for (GLuint attrib = 1; attrib <= 3; ++attrib) {
+        glEnableVertexAttribArray(attrib);
+        glVertexAttribDivisor(attrib, 1);
       }
-
-      glVertexAttribIPointer(5, 1, GL_INT, sizeof(fruit_body),
-                             (void *)offsetof(fruit_body, id));
-      glEnableVertexAttribArray(5);
-      glVertexAttribDivisor(5, 1);
     }
     glBindBuffer(GL_ARRAY_BUFFER, 0);
   }
@@ -361,7 +906,13 @@ void sdlgl_init(sdlgl_state *s, int width, int height, arena memory) {
       ;
 
   GLuint box_program = compile_shader(box_vert_code, box_frag_code);
-  glUseProgram(box_program);
+  {
+    // The box never moves
+    mat4 model = glm::translate(mat4(1.0f), vec3(0, 0, 1));
+    glUseProgram(box_program);
+    glUniformMatrix4fv(glGetUniformLocation(box_program, "model"), 1,
+                       GL_FALSE, glm::value_ptr(model));
+  }
 
   int box_num_tris = 10;
   GLuint box_mesh_vao;
@@ -384,21 +935,6 @@ void sdlgl_init(sdlgl_state *s, int width, int height, arena memory) {
   }
   glBindVertexArray(0);
 
-  {
-    arena scratch = memory;
-    vec3 *tris = arena_push<vec3>(&scratch, 3 * sphere_num_tris);
-    make_UV_sphere_tris(ndu, ndv, tris, &scratch);
-
-    printf("Generating fruit with %i tris,%i verts\n", sphere_num_tris,
-           3 * sphere_num_tris);
-    glBindVertexArray(sphere_mesh_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, sphere_mesh_vbo);
-    glBufferData(GL_ARRAY_BUFFER, 3 * sphere_num_tris * 3 * (iZ)sizeof(GLfloat),
-                 tris, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-  }
-
   {
     arena scratch = memory;
     vec3 *tris = arena_push<vec3>(&scratch, 6 * box_num_tris);
@@ -412,24 +948,192 @@ void sdlgl_init(sdlgl_state *s, int width, int height, arena memory) {
     glBindVertexArray(0);
   }
 
-  glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  SDL_GL_SwapWindow(window);
+  const char *outline_vert_code =
+#include "../shaders/outline.vert"
+      ;
+  const char *outline_frag_code =
+#include "../shaders/outline.frag"
+      ;
+  GLuint outline_program = compile_shader(outline_vert_code, outline_frag_code);
+  GLuint outline_vao;
+  glGenVertexArrays(1, &outline_vao);
+  glUseProgram(outline_program);
+  glUniform1i(glGetUniformLocation(outline_program, "scene_colour"), 0);
+  glUniform1i(glGetUniformLocation(outline_program, "scene_fruit"), 1);
+  glUniform1i(glGetUniformLocation(outline_program, "scene_depth"), 2);
+  glUniform1f(glGetUniformLocation(outline_program, "width"),
+              SDLGL_OUTLINE_PIXELS);
+
+  // Screen sized targets for the single pass, the fruit covering each pixel
+  // goes alongside the colour
+  GLuint scene_fbo, scene_textures[3];
+  glGenFramebuffers(1, &scene_fbo);
+  glGenTextures(3, scene_textures);
+  {
+    GLenum internal_formats[3] = {GL_RGBA8, GL_RG16UI, GL_DEPTH_COMPONENT24};
+    GLenum formats[3] = {GL_RGBA, GL_RG_INTEGER, GL_DEPTH_COMPONENT};
+    GLenum types[3] = {GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT};
+    GLenum attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                             GL_DEPTH_ATTACHMENT};
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+    for (int k = 0; k < 3; ++k) {
+      glBindTexture(GL_TEXTURE_2D, scene_textures[k]);
+      glTexImage2D(GL_TEXTURE_2D, 0, (GLint)internal_formats[k], width,
+                   height, 0, formats[k], types[k], nullptr);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, attachments[k], GL_TEXTURE_2D,
+                             scene_textures[k], 0);
+    }
+    glDrawBuffers(2, attachments);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      puts("Screen space outline framebuffer is incomplete");
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  GLuint timer_queries[SDLGL_TIMER_QUERIES];
+  bool has_timer_query =
+      headless ? has_extension((const char *)glGetString(GL_EXTENSIONS),
+                               "GL_EXT_disjoint_timer_query")
+               : SDL_GL_ExtensionSupported("GL_EXT_disjoint_timer_query");
+  if (has_timer_query) {
+    glGenQueries(SDLGL_TIMER_QUERIES, timer_queries);
+  } else {
+    puts("No GL_EXT_disjoint_timer_query, GPU times won't be reported");
+  }
+
+  // Filled every frame, for every program that draws in world space
+  GLuint camera_ubo;
+  glGenBuffers(1, &camera_ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, camera_ubo);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(camera_block), nullptr,
+               GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, SDLGL_CAMERA_BINDING, camera_ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  for (GLuint program : {fruit_program, box_program}) {
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "camera"),
+                          SDLGL_CAMERA_BINDING);
+  }
+
+  // Never changes, so it goes once
+  fruit_types_block fruit_types = {};
+  for (u32 t = 0; t < FRUIT_TYPES; ++t) {
+    const fruit_type &type = TABLE_fruit_type[t];
+    fruit_types.dims[t] =
+        vec4(type.radii[0], type.radii[1], type.radii[2], 0.0f);
+    fruit_types.colours[t] =
+        vec4(type.colour[0], type.colour[1], type.colour[2], 1.0f);
+  }
+  GLuint fruit_types_ubo;
+  glGenBuffers(1, &fruit_types_ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, fruit_types_ubo);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(fruit_types_block), &fruit_types,
+               GL_STATIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, SDLGL_FRUIT_TYPES_BINDING,
+                   fruit_types_ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  for (GLuint program : {fruit_program, outline_program}) {
+    glUniformBlockBinding(program,
+                          glGetUniformBlockIndex(program, "fruit_types"),
+                          SDLGL_FRUIT_TYPES_BINDING);
+  }
+
+  // Everything else is left as new_gl_state_cache expects
+  glUseProgram(0);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  GLfloat clear_colour[4] = {1.0f, 0.0f, 0.0f, 1.0f};
+  glClearColor(clear_colour[0], clear_colour[1], clear_colour[2],
+               clear_colour[3]);
+  if (window) {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    SDL_GL_SwapWindow(window);
+  }
 
   melon_state game{};
-  melon_init(&game, &memory);
+  melon_init(&game, &memory, solver);
+
+  fruit_instance *instances = arena_push<fruit_instance>(&memory, MAX_FRUIT);
+  u32 *instance_version = arena_push<u32>(&memory, MAX_FRUIT);
+  memset(instance_version, 0, MAX_FRUIT * sizeof(u32));
+  fruit_draw_list draw_list = new_fruit_draw_list(&memory, MAX_FRUIT);
+  u16 *buffer_slot_fruit[SDLGL_INSTANCE_BUFFERS];
+  u32 *buffer_slot_version[SDLGL_INSTANCE_BUFFERS];
+  for (int k = 0; k < SDLGL_INSTANCE_BUFFERS; ++k) {
+    // Nothing matches until it's been sent
+    buffer_slot_fruit[k] = arena_push<u16>(&memory, MAX_FRUIT);
+    buffer_slot_version[k] = arena_push<u32>(&memory, MAX_FRUIT);
+    memset(buffer_slot_fruit[k], 0xFF, MAX_FRUIT * sizeof(u16));
+  }
 
   s->width = width;
   s->height = height;
 
   s->window = window;
   s->keyb = SDL_GetKeyboardState(0);
+  s->title_num_awake = s->title_num_fruit = -1;
+  s->title_substeps = -1;
+  s->title_tris = -1;
+  s->last_frame_time = SDL_GetPerformanceCounter();
+
+  s->gl = new_gl_state_cache();
+  s->ubo_camera = camera_ubo;
+  s->ubo_fruit_types = fruit_types_ubo;
+  s->proj_view = mat4(1.0f);
+  for (int k = 0; k < 4; ++k) {
+    s->clear_colour[k] = clear_colour[k];
+  }
 
   s->prog_fruit = fruit_program;
-  s->vao_fruit = sphere_mesh_vao;
+  s->loc_fruit_outline = loc_fruit_outline;
+  s->loc_fruit_first_slot = loc_fruit_first_slot;
   s->vbo_sphere = sphere_mesh_vbo;
-  s->sphere_num_verts = sphere_num_tris * 3;
-  s->vbo_fruit_instances = fruit_instance_vbo;
+  s->ibo_sphere = sphere_mesh_ibo;
+  for (int lod = 0; lod < FRUIT_LODS; ++lod) {
+    s->sphere_lod_indices[lod] = sphere_lod_indices[lod];
+    s->sphere_lod_offset[lod] = sphere_lod_offset[lod];
+  }
+  for (int k = 0; k < SDLGL_INSTANCE_BUFFERS; ++k) {
+    s->vao_fruit[k] = fruit_vaos[k];
+    s->vbo_fruit_instances[k] = fruit_instance_vbos[k];
+    s->buffer_slot_fruit[k] = buffer_slot_fruit[k];
+    s->buffer_slot_version[k] = buffer_slot_version[k];
+  }
+  s->instance_buffer = 0;
+  s->instances = instances;
+  s->instance_version = instance_version;
+  s->draw_list = draw_list;
+  s->frame_tris = s->frame_verts = 0;
+
+  s->outline = OUTLINE_INFLATED;
+  s->outline_compare = false;
+  s->prog_outline = outline_program;
+  s->vao_outline = outline_vao;
+  s->fbo_scene = scene_fbo;
+  s->tex_scene_colour = scene_textures[0];
+  s->tex_scene_fruit = scene_textures[1];
+  s->tex_scene_depth = scene_textures[2];
+
+  s->has_timer_query = has_timer_query;
+  for (int k = 0; k < SDLGL_TIMER_QUERIES; ++k) {
+    s->timer_queries[k] = has_timer_query ? timer_queries[k] : 0;
+    s->timer_query_pending[k] = false;
+    s->timer_query_outline[k] = OUTLINE_INFLATED;
+  }
+  s->next_timer_query = 0;
+  s->timer_running = false;
+  for (int mode = 0; mode < OUTLINE_MODES; ++mode) {
+    s->gpu_ns[mode] = 0;
+    s->gpu_frames[mode] = 0;
+    s->gl_calls[mode] = s->gl_skipped[mode] = 0;
+    s->gl_frames[mode] = 0;
+    s->wall_ns[mode] = 0;
+    s->wall_frames[mode] = 0;
+  }
+  s->frame = 0;
 
   s->prog_box = box_program;
   s->vao_box = box_mesh_vao;
@@ -437,27 +1141,132 @@ void sdlgl_init(sdlgl_state *s, int width, int height, arena memory) {
   s->box_num_verts = box_num_tris * 3;
 
   s->memory = memory;
+  s->frame_memory = new_arena(SDLGL_FRAME_RESERVE, "frame");
 
   s->camera_pos = vec3(0, -2, 1);
 
   s->game = game;
+  s->sim = new_sim_thread(&s->memory, &s->game, SDLGL_FRAME_RESERVE);
+
+  s->record_path = nullptr;
+  s->frame_durations.count = 0;
+  s->frame_durations.last_ns = 0;
+  s->trace_path = "trace.json";
+  s->trace_on_quit = false;
+
+  s->headless = headless;
+  s->fbo_target = target_fbo;
+  s->rbo_target_colour = target_rbos[0];
+  s->rbo_target_depth = target_rbos[1];
+  s->headless_frames = 0;
+  s->headless_start_ns = 0;
+  s->dump_dir = nullptr;
+}
+
+#define RECORD_MAX_EVENTS (1 << 16)
+
+void sdlgl_start_recording(sdlgl_state *s, const char *path) {
+  s->record_path = path;
+  s->record_log = new_input_log(&s->memory, RECORD_MAX_EVENTS);
+  melon_start_recording(&s->game, &s->record_log);
+}
+
+void sdlgl_set_outline(sdlgl_state *s, const char *name) {
+  for (int mode = 0; mode < OUTLINE_MODES; ++mode) {
+    if (!strcmp(name, TABLE_outline_name[mode])) {
+      s->outline = (sdlgl_outline)mode;
+      return;
+    }
+  }
+  printf("No outline mode %s\n", name);
+}
+
+void sdlgl_set_trace(sdlgl_state *s, const char *path) {
+  s->trace_path = path;
+  s->trace_on_quit = true;
+}
+
+void sdlgl_set_headless_run(sdlgl_state *s, u64 frames, const char *dir) {
+  ASSERT(s->headless);
+  s->headless_frames = frames;
+  s->dump_dir = dir;
+}
+
+// Loosely stacked above the box like the bench's drop scene, in types that
+// cycle so neighbours don't all merge as soon as they land
+void sdlgl_add_fruit(sdlgl_state *s, iZ num) {
+  melon_state *m = &s->game;
+  int per_row = 4;
+  float spacing = 0.4f;
+  num = glm::min(num, MAX_FRUIT - m->bodies.num);
+  for (iZ i = 0; i < num; ++i) {
+    vec3 p;
+    p.x = ((float)(i % per_row) - per_row / 2.0f + 0.5f) * spacing;
+    p.y = ((float)(i / per_row % per_row) - per_row / 2.0f + 0.5f) * spacing;
+    p.z = (float)BOX_HEIGHT + (float)(i / (per_row * per_row)) * spacing;
+    add_fruit(m, p, (int)(i * 5 % FRUIT_MELON));
+  }
+}
+
+// Writes out everything asked for on the command line, then exits
+void sdlgl_quit(sdlgl_state *s, arena *mem) {
+  free_sim_thread(s->sim);
+  if (s->record_path) {
+    melon_stop_recording(&s->game);
+    save_input_log(&s->record_log, s->record_path, mem);
+  }
+  frame_times_report(&s->frame_durations, mem);
+  if (s->headless) {
+    double seconds = (double)(trace_now_ns() - s->headless_start_ns) / 1e9;
+    printf("headless frames=%llu fruit=%td size=%dx%d outline=%s "
+           "seconds=%.2f fps=%.1f\n",
+           (unsigned long long)s->frame, s->title_num_fruit, s->width,
+           s->height, TABLE_outline_name[s->outline], seconds,
+           (double)s->frame / seconds);
+    fflush(stdout);
+  }
+  if (s->trace_on_quit) {
+    trace_dump_chrome(s->trace_path);
+  }
+#if SDLGL_HEADLESS
+  if (s->headless) {
+    eglMakeCurrent(s->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroyContext(s->egl_display, s->egl_context);
+    eglTerminate(s->egl_display);
+  }
+#endif
+  exit(0);
 }
 
 void process_event_queue(sdlgl_state *s, arena *mem) {
+  TRACE_SCOPE("events");
   SDL_Event e;
   while (SDL_PollEvent(&e)) {
     switch (e.type) {
     case SDL_QUIT: {
-      exit(0);
+      sdlgl_quit(s, mem);
     } break;
     case SDL_MOUSEMOTION: {
-      melon_mousemotion(&s->game);
+      sim_thread_input(s->sim, INPUT_MOUSEMOTION);
     } break;
     case SDL_MOUSEBUTTONDOWN: {
-      melon_mousedown(&s->game);
+      sim_thread_input(s->sim, INPUT_MOUSEDOWN);
     } break;
     case SDL_MOUSEBUTTONUP: {
-      melon_mouseup(&s->game);
+      sim_thread_input(s->sim, INPUT_MOUSEUP);
+    } break;
+    case SDL_KEYDOWN: {
+      // O switches between the outline modes
+      if (e.key.keysym.scancode == SDL_SCANCODE_O && !e.key.repeat) {
+        s->outline = (sdlgl_outline)((s->outline + 1) % OUTLINE_MODES);
+        printf("Outline mode %s\n", TABLE_outline_name[s->outline]);
+      }
+      // T writes out the trace and frame times so far
+      if (e.key.keysym.scancode == SDL_SCANCODE_T && !e.key.repeat) {
+        frame_times_report(&s->frame_durations, mem);
+        trace_dump_chrome(s->trace_path);
+      }
     } break;
     }
   }
@@ -476,18 +1285,105 @@ void process_event_queue(sdlgl_state *s, arena *mem) {
 }
 
 void sdlgl_loop(sdlgl_state *s) {
-  arena frame_memory = arena_split(&s->memory, 8_MB);
-  process_event_queue(s, &frame_memory);
+  frame_times_mark(&s->frame_durations);
+  u64 frame_start_ns = trace_now_ns();
+  TRACE_SCOPE("frame");
+  arena frame_memory = s->frame_memory;
+  arena_new_frame(&frame_memory);
+  arena_new_frame(&s->memory);
+  float seconds = SDLGL_HEADLESS_DT;
+  if (s->headless) {
+    if (s->frame == 0) {
+      s->headless_start_ns = trace_now_ns();
+    }
+  } else {
+    process_event_queue(s, &frame_memory);
+
+    u64 now = SDL_GetPerformanceCounter();
+    seconds = (float)(now - s->last_frame_time) /
+              (float)SDL_GetPerformanceFrequency();
+    s->last_frame_time = now;
+  }
 
+  // The sim works on this frame while the last one it finished is drawn
+  sim_thread_frame(s->sim, seconds);
   renderer_input stuff_to_upload;
-  melon_tick(&s->game, &stuff_to_upload, &frame_memory);
+  sim_thread_latest(s->sim, &stuff_to_upload);
+
+  array<render_cmd> cmds =
+      new_array<render_cmd>(&frame_memory, RENDER_MAX_CMDS);
+  s->gl.calls = s->gl.skipped = 0;
+
+  record_camera(s, &cmds, &frame_memory);
+  upload_fruit_instances(s, &stuff_to_upload, &cmds, &frame_memory);
+  render_push(&cmds, {.type = RENDER_FRAMEBUFFER, .object = s->fbo_target});
+  render_push(&cmds, {.type = RENDER_CLEAR,
+                      .clear_mask = GL_COLOR_BUFFER_BIT |
+                                    GL_DEPTH_BUFFER_BIT});
+  gpu_timer_begin(s, &cmds);
+  draw_fruit(s, &cmds);
+  gpu_timer_end(s, &cmds);
+  draw_box(s, &cmds);
+  render_submit(s, &cmds);
+
+  sdlgl_outline drawn = s->outline;
+  s->gl_calls[drawn] += s->gl.calls;
+  s->gl_skipped[drawn] += s->gl.skipped;
+  s->gl_frames[drawn]++;
+
+  if (stuff_to_upload.num_awake != s->title_num_awake ||
+      stuff_to_upload.num_fruit != s->title_num_fruit ||
+      stuff_to_upload.substeps != s->title_substeps ||
+      s->frame_tris != s->title_tris) {
+    char title[128];
+    snprintf(title, sizeof(title),
+             "Melon - %td awake, %td asleep, %d substeps, %td tris, "
+             "%td verts",
+             stuff_to_upload.num_awake,
+             stuff_to_upload.num_fruit - stuff_to_upload.num_awake,
+             stuff_to_upload.substeps, s->frame_tris, s->frame_verts);
+    if (s->window) {
+      SDL_SetWindowTitle(s->window, title);
+    }
+    s->title_num_awake = stuff_to_upload.num_awake;
+    s->title_num_fruit = stuff_to_upload.num_fruit;
+    s->title_substeps = stuff_to_upload.substeps;
+    s->title_tris = s->frame_tris;
+  }
 
-  upload_fruit_instances(s, stuff_to_upload.fruit, stuff_to_upload.num_fruit);
+  if (s->headless) {
+    // Nothing to swap, the frame's done once the GPU has finished it
+    TRACE_SCOPE("finish");
+    glFinish();
+  } else {
+    TRACE_SCOPE("swap");
+    SDL_GL_SwapWindow(s->window);
+  }
+  s->wall_ns[drawn] += trace_now_ns() - frame_start_ns;
+  s->wall_frames[drawn]++;
+
+  // After the swap, so the window reported holds this frame's wall time
+  if (++s->frame % SDLGL_TIMING_FRAMES == 0) {
+    report_gpu_times(s);
+    arena_report();
+    if (s->outline_compare) {
+      s->outline = (sdlgl_outline)((s->outline + 1) % OUTLINE_MODES);
+    }
+  }
 
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  draw_fruit(s, stuff_to_upload.num_fruit);
-  draw_box(s);
-  SDL_GL_SwapWindow(s->window);
+  if (s->headless) {
+    if (s->dump_dir) {
+      dump_frame(s, &frame_memory);
+    }
+    if (s->frame >= s->headless_frames) {
+      sdlgl_quit(s, &frame_memory);
+    }
+  }
 
-  arena_rejoin(&s->memory, &frame_memory);
+  // Nothing from this frame is needed any more. Spikes don't get to keep
+  // their pages, twice this frame's peak does.
+  if (s->frame % SDLGL_TIMING_FRAMES == 0) {
+    arena_trim(&s->frame_memory,
+               2 * s->frame_memory.block->frame_peak.load());
+  }
 }
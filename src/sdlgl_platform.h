@@ -1,6 +1,9 @@
 #pragma once
 
+#include "fruit_instance.h"
 #include "melongame.h"
+#include "sim_thread.h"
+#include "trace.h"
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_config.h>
@@ -8,18 +11,240 @@
 #include <GLES2/gl2ext.h>
 #include <GLES3/gl3platform.h>
 
+// Headless rendering needs EGL's surfaceless platform, which only native
+// Linux (Mesa) has
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define SDLGL_HEADLESS 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#define SDLGL_HEADLESS 0
+#endif
+
+#define SDLGL_FOV_Y 69.0f // Degrees
+
+// How the dark rim around each fruit is drawn
+enum sdlgl_outline : int {
+  OUTLINE_INFLATED, // Back faces of a slightly bigger copy, a second pass
+  OUTLINE_SCREEN,   // Edges found in screen space after a single pass
+  OUTLINE_MODES
+};
+
+const char *const TABLE_outline_name[OUTLINE_MODES] = {"inflated", "screen"};
+
+#define SDLGL_OUTLINE_PIXELS 2.0f
+
+// GPU time queries in flight, read back this many frames late
+#define SDLGL_TIMER_QUERIES 4
+// Frames between printed GPU times
+#define SDLGL_TIMING_FRAMES 120
+
+#define SDLGL_INSTANCE_BUFFERS 3
+
+// Per frame scratch, for the render thread and the sim thread's
+// melon_advance
+#define SDLGL_FRAME_RESERVE ARENA_RESERVE(1_GB, 8_MB)
+
+// Runs of changed instances closer than this are sent as one
+#define SDLGL_UPLOAD_MERGE_GAP 8
+
+// Headless frames all advance the game by this much, however long they take
+#define SDLGL_HEADLESS_DT (1.0f / 60.0f)
+
+/*     ======  Render commands ======
+ * Passes don't talk to GL themselves, they record commands into a buffer
+ * from the frame arena. sdlgl_loop submits it once they're all recorded,
+ * through a cache of what's already set on the context, so binds, enables
+ * and uniforms that wouldn't change anything are dropped.
+ */
+
+// Fixed function state a draw relies on, set all at once
+struct render_state {
+  bool depth_test;
+  bool blend; // GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA
+  bool cull_face;
+  GLenum front_face;
+  GLenum depth_func;
+};
+
+enum render_cmd_type : u8 {
+  RENDER_FRAMEBUFFER,
+  RENDER_CLEAR,       // fbo_target
+  RENDER_CLEAR_SCENE, // fbo_scene's colour, fruit and depth
+  RENDER_STATE,
+  RENDER_PROGRAM,
+  RENDER_VAO,
+  RENDER_TEXTURE,
+  RENDER_UNIFORM_1F,
+  RENDER_UNIFORM_1UI,
+  RENDER_BUFFER_DATA, // glBufferSubData
+  RENDER_INSTANCE_ATTRIBS,
+  RENDER_DRAW_ARRAYS,
+  RENDER_DRAW_INSTANCED, // u16 indices from the bound VAO
+  RENDER_QUERY_BEGIN,    // GL_TIME_ELAPSED_EXT
+  RENDER_QUERY_END,
+};
+
+struct render_cmd {
+  render_cmd_type type;
+  union {
+    GLuint object; // Framebuffer, program, VAO or query
+    GLbitfield clear_mask;
+    render_state state;
+    struct {
+      GLuint unit;
+      GLuint texture;
+    } texture;
+    struct {
+      GLint location;
+      u32 bits; // Float or uint
+    } uniform;
+    struct {
+      GLenum target;
+      GLuint buffer;
+      iZ offset;
+      iZ size;
+      const void *data; // Has to last until the commands are submitted
+    } buffer_data;
+    struct {
+      GLuint buffer;
+      iZ first; // Instance the attributes start from
+    } instance_attribs;
+    struct {
+      GLint first;
+      GLsizei count;
+    } draw_arrays;
+    struct {
+      GLsizei count;
+      iZ offset; // Into the index buffer, in bytes
+      GLsizei instances;
+    } draw_instanced;
+  };
+};
+
+#define RENDER_MAX_CMDS 256
+#define RENDER_TEXTURE_UNITS 3
+#define RENDER_CACHED_UNIFORMS 16
+
+// What the context has been left with
+struct gl_state_cache {
+  render_state state;
+  GLuint framebuffer;
+  GLuint program;
+  GLuint vao;
+  GLuint buffers[2]; // GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER
+  GLuint active_texture;
+  GLuint textures[RENDER_TEXTURE_UNITS];
+
+  // Uniform values by program and location, the program keeps them
+  struct {
+    GLuint program;
+    GLint location;
+    u32 bits;
+  } uniforms[RENDER_CACHED_UNIFORMS];
+  int num_uniforms;
+
+  int calls;   // GL calls made this frame
+  int skipped; // Commands this frame that were already the case
+};
+
+// std140 layout of the camera block in the vertex shaders, filled once a
+// frame for every pass
+struct camera_block {
+  mat4 proj_view;
+};
+
+#define SDLGL_CAMERA_BINDING 0
+
+// std140 layout of the fruit_types block in fruit.vert and outline.frag,
+// TABLE_fruit_type sent once at init. The shaders have room for this many.
+#define SDLGL_MAX_FRUIT_TYPES 64
+
+struct fruit_types_block {
+  vec4 dims[SDLGL_MAX_FRUIT_TYPES];
+  vec4 colours[SDLGL_MAX_FRUIT_TYPES];
+};
+
+static_assert(FRUIT_TYPES <= SDLGL_MAX_FRUIT_TYPES);
+
+#define SDLGL_FRUIT_TYPES_BINDING 1
+
 struct sdlgl_state {
   int width;
   int height;
 
   SDL_Window  *window;
   const Uint8 *keyb;
+  iZ title_num_awake; // Counts last shown in the window title
+  iZ title_num_fruit;
+  int title_substeps;
+  iZ title_tris;
+  u64 last_frame_time; // SDL_GetPerformanceCounter at the last frame
+
+  gl_state_cache gl;
+  GLuint ubo_camera;
+  GLuint ubo_fruit_types;
+  mat4 proj_view; // This frame's, as in ubo_camera
+  GLfloat clear_colour[4];
 
   GLuint prog_fruit;
-  GLuint vao_fruit;
+  GLint  loc_fruit_outline;
+  GLint  loc_fruit_first_slot;
+  // Every LOD's sphere in one vertex and one index buffer
   GLuint vbo_sphere;
-  GLint  sphere_num_verts;
-  GLuint vbo_fruit_instances;
+  GLuint ibo_sphere;
+  GLsizei sphere_lod_indices[FRUIT_LODS];
+  iZ      sphere_lod_offset[FRUIT_LODS]; // Into ibo_sphere, in bytes
+
+  // Instances stream through a ring of buffers, one VAO each, so a frame
+  // never writes to what the last ones might still be drawing from. Slots
+  // are filled in draw list order, and only sent again when a different
+  // fruit lands in them or theirs has moved since.
+  GLuint vao_fruit[SDLGL_INSTANCE_BUFFERS];
+  GLuint vbo_fruit_instances[SDLGL_INSTANCE_BUFFERS];
+  u16   *buffer_slot_fruit[SDLGL_INSTANCE_BUFFERS];
+  u32   *buffer_slot_version[SDLGL_INSTANCE_BUFFERS];
+  int    instance_buffer; // The one drawn from this frame
+
+  fruit_instance *instances; // Every fruit, packed as of when it last moved
+  u32 *instance_version;    // Bumped every time it's packed
+  fruit_draw_list draw_list;
+
+  // What draw_fruit sent this frame, every pass
+  iZ frame_tris;
+  iZ frame_verts;
+
+  sdlgl_outline outline;
+  bool outline_compare; // Switch modes every SDLGL_TIMING_FRAMES
+
+  // Screen space outlines draw the fruit here first
+  GLuint prog_outline;
+  GLuint vao_outline;
+  GLuint fbo_scene;
+  GLuint tex_scene_colour;
+  GLuint tex_scene_fruit;
+  GLuint tex_scene_depth;
+
+  // draw_fruit's GPU time, summed per outline mode until it's next printed
+  bool   has_timer_query;
+  GLuint timer_queries[SDLGL_TIMER_QUERIES];
+  bool   timer_query_pending[SDLGL_TIMER_QUERIES];
+  sdlgl_outline timer_query_outline[SDLGL_TIMER_QUERIES];
+  int    next_timer_query;
+  bool   timer_running;
+  u64    gpu_ns[OUTLINE_MODES];
+  int    gpu_frames[OUTLINE_MODES];
+  u64    frame;
+  // GL calls made and dropped by the cache, summed the same way
+  i64    gl_calls[OUTLINE_MODES];
+  i64    gl_skipped[OUTLINE_MODES];
+  int    gl_frames[OUTLINE_MODES];
+  // Through the swap, or headless through glFinish. Software GL (llvmpipe)
+  // rasterises at the flush, outside the timer queries, so there this is
+  // what tells the modes apart. A frame's time lands after the report it
+  // ended in.
+  u64    wall_ns[OUTLINE_MODES];
+  int    wall_frames[OUTLINE_MODES];
 
   GLuint prog_box;
   GLuint vao_box;
@@ -27,11 +252,42 @@ struct sdlgl_state {
   GLint  box_num_verts;
 
   arena memory;
+  arena frame_memory; // Reset every frame
 
   vec3 camera_pos;
 
-  melon_state game;
+  melon_state game; // The sim thread's while it's running
+  sim_thread *sim;
+
+  const char *record_path; // Input log written here on quit, if set
+  input_log record_log;
+
+  frame_times frame_durations;
+  const char *trace_path; // T writes the trace here, and so does quitting
+  bool trace_on_quit;     // if it was asked for with --trace
+
+  // Headless there's no window or vsync, frames go to an offscreen
+  // framebuffer through a surfaceless EGL context instead
+  bool headless;
+  GLuint fbo_target; // Where frames end up, the window's is 0
+  GLuint rbo_target_colour;
+  GLuint rbo_target_depth;
+  u64 headless_frames;   // Quits once this many have been drawn
+  u64 headless_start_ns; // When the first one started
+  const char *dump_dir;  // Each headless frame is written here, if set
+#if SDLGL_HEADLESS
+  EGLDisplay egl_display;
+  EGLContext egl_context;
+#endif
 };
 
-void sdlgl_init(sdlgl_state *, int w, int h, arena *p, arena *t);
+void sdlgl_init(sdlgl_state *, int w, int h, arena memory, physics_solver,
+                bool headless);
+// Drops num fruit into the box, before the first sdlgl_loop
+void sdlgl_add_fruit(sdlgl_state *, iZ num);
+// Headless, quits after frames, writing each one into dir if it isn't null
+void sdlgl_set_headless_run(sdlgl_state *, u64 frames, const char *dir);
+void sdlgl_start_recording(sdlgl_state *, const char *path);
+void sdlgl_set_outline(sdlgl_state *, const char *name);
+void sdlgl_set_trace(sdlgl_state *, const char *path);
 void sdlgl_loop(sdlgl_state *);
@@ -0,0 +1,153 @@
+#include "sim_thread.h"
+#include "trace.h"
+
+#include <new>
+
+void sim_publish(sim_thread *sim, const renderer_input *ri) {
+  sim_snapshot *snap = &sim->snapshots[sim->back];
+  for (iZ i = 0; i < ri->num_fruit; ++i) {
+    sim->unseen[i] |= ri->moved[i];
+    snap->fruit[i] = ri->fruit[i];
+    snap->moved[i] = sim->unseen[i];
+  }
+  snap->num_fruit = ri->num_fruit;
+  snap->num_awake = ri->num_awake;
+  snap->substeps = ri->substeps;
+
+  u32 old = sim->ready.exchange((u32)sim->back | SIM_SNAPSHOT_FRESH,
+                                std::memory_order_acq_rel);
+  sim->back = (int)(old & ~SIM_SNAPSHOT_FRESH);
+  if (!(old & SIM_SNAPSHOT_FRESH)) {
+    // The last one was taken, only this one's moves might not have been seen
+    for (iZ i = 0; i < ri->num_fruit; ++i) {
+      sim->unseen[i] = ri->moved[i];
+    }
+  }
+}
+
+// Handles everything sent so far, frames together as one melon_advance.
+// False once told to quit.
+bool sim_thread_step(sim_thread *sim) {
+  u32 tail = sim->queue_tail.load(std::memory_order_relaxed);
+  u32 head = sim->queue_head.load(std::memory_order_acquire);
+  bool running = true;
+  bool frame = false;
+  float seconds = 0.0f;
+  for (; tail != head; ++tail) {
+    sim_message msg = sim->queue[tail % SIM_QUEUE_SIZE];
+    switch (msg.type) {
+    case SIM_INPUT: {
+      melon_apply_input(sim->game, msg.input);
+    } break;
+    case SIM_FRAME: {
+      seconds += msg.seconds;
+      frame = true;
+    } break;
+    case SIM_QUIT: {
+      running = false;
+    } break;
+    }
+  }
+  sim->queue_tail.store(tail, std::memory_order_release);
+
+  if (frame) {
+    TRACE_SCOPE("sim advance");
+    arena frame_memory = sim->frame_memory;
+    arena_new_frame(&frame_memory);
+    renderer_input ri;
+    melon_advance(sim->game, seconds, &ri, &frame_memory);
+    sim_publish(sim, &ri);
+  }
+  return running;
+}
+
+#if SIM_THREADED
+void sim_thread_main(sim_thread *sim) {
+  while (sim_thread_step(sim)) {
+    u32 seen = sim->queue_tail.load(std::memory_order_relaxed);
+    sim->queue_head.wait(seen, std::memory_order_acquire);
+  }
+}
+#endif
+
+void sim_push(sim_thread *sim, sim_message msg) {
+  u32 head = sim->queue_head.load(std::memory_order_relaxed);
+  // Only full when the sim is far behind, so wait for it
+  while (head - sim->queue_tail.load(std::memory_order_acquire) ==
+         SIM_QUEUE_SIZE) {
+#if SIM_THREADED
+    std::this_thread::yield();
+#else
+    sim_thread_step(sim);
+#endif
+  }
+  sim->queue[head % SIM_QUEUE_SIZE] = msg;
+  sim->queue_head.store(head + 1, std::memory_order_release);
+#if SIM_THREADED
+  sim->queue_head.notify_one();
+#endif
+}
+
+sim_thread *new_sim_thread(arena *mem, melon_state *game,
+                           iZ frame_reserve) {
+  sim_thread *sim = new (arena_push<sim_thread>(mem, 1)) sim_thread;
+  sim->game = game;
+  sim->frame_memory = new_arena(frame_reserve, "sim frame");
+  sim->queue_head = 0;
+  sim->queue_tail = 0;
+  for (sim_snapshot &snap : sim->snapshots) {
+    snap.fruit = arena_push<fruit_body>(mem, MAX_FRUIT);
+    snap.moved = arena_push<bool>(mem, MAX_FRUIT);
+    snap.num_fruit = snap.num_awake = 0;
+    snap.substeps = game->physics.substeps;
+  }
+  sim->back = 0;
+  sim->ready = 1;
+  sim->front = 2;
+  sim->unseen = arena_push<bool>(mem, MAX_FRUIT);
+  memset(sim->unseen, 0, MAX_FRUIT * sizeof(bool));
+#if SIM_THREADED
+  sim->thread = std::thread(sim_thread_main, sim);
+#endif
+  return sim;
+}
+
+void free_sim_thread(sim_thread *sim) {
+  sim_push(sim, {.type = SIM_QUIT});
+#if SIM_THREADED
+  sim->thread.join();
+#else
+  sim_thread_step(sim);
+#endif
+  free_arena(&sim->frame_memory);
+  sim->~sim_thread();
+}
+
+void sim_thread_input(sim_thread *sim, input_event_type type) {
+  sim_push(sim, {.type = SIM_INPUT, .input = type});
+}
+
+void sim_thread_frame(sim_thread *sim, float seconds) {
+  sim_push(sim, {.type = SIM_FRAME, .seconds = seconds});
+#if !SIM_THREADED
+  sim_thread_step(sim);
+#endif
+}
+
+void sim_thread_latest(sim_thread *sim, renderer_input *ri) {
+  sim_snapshot *snap;
+  if (sim->ready.load(std::memory_order_relaxed) & SIM_SNAPSHOT_FRESH) {
+    u32 old = sim->ready.exchange((u32)sim->front, std::memory_order_acq_rel);
+    sim->front = (int)(old & ~SIM_SNAPSHOT_FRESH);
+    snap = &sim->snapshots[sim->front];
+  } else {
+    // Already drawn, nothing's moved since
+    snap = &sim->snapshots[sim->front];
+    memset(snap->moved, 0, (uZ)snap->num_fruit * sizeof(bool));
+  }
+  ri->fruit = snap->fruit;
+  ri->moved = snap->moved;
+  ri->num_fruit = snap->num_fruit;
+  ri->num_awake = snap->num_awake;
+  ri->substeps = snap->substeps;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "input_log.h"
+#include "jobs.h"
+#include "melongame.h"
+#include "types.h"
+
+#include <atomic>
+
+/*     ======  Simulation thread ======
+ * Runs melon_advance on a thread of its own, so the ticks for the next frame
+ * overlap drawing and swapping the last one.
+ *
+ * The render thread sends input and frame times through a single producer,
+ * single consumer ring, and takes the newest finished snapshot of the fruit
+ * from a triple buffer. Neither side takes a lock, the sim thread sleeps on
+ * the ring's write count when there's nothing for it.
+ *
+ * Snapshots the renderer never took still had fruit move in them, so moved
+ * flags carry over into the next one until one is known to have been taken.
+ *
+ * Without threads (single threaded WASM) sim_thread_frame runs the sim on
+ * the caller, and the renderer gets the frame it just asked for.
+ */
+
+#define SIM_THREADED JOBS_THREADED
+
+#define SIM_QUEUE_SIZE 256 // Power of two
+
+enum sim_message_type : u8 {
+  SIM_INPUT,
+  SIM_FRAME, // Advance by seconds
+  SIM_QUIT,
+};
+
+struct sim_message {
+  sim_message_type type;
+  input_event_type input;
+  float seconds;
+};
+
+// A renderer_input that owns its arrays
+struct sim_snapshot {
+  fruit_body *fruit;
+  bool *moved; // Since the last snapshot the renderer took
+  iZ num_fruit;
+  iZ num_awake;
+  int substeps;
+};
+
+// Set on sim_thread::ready until the renderer takes it
+#define SIM_SNAPSHOT_FRESH 4u
+
+struct sim_thread {
+  melon_state *game;
+  arena frame_memory; // Its own, reset for every melon_advance
+
+  sim_message queue[SIM_QUEUE_SIZE];
+  std::atomic<u32> queue_head; // Messages pushed
+  std::atomic<u32> queue_tail; // Messages popped
+
+  // The sim fills snapshots[back] then swaps it with ready, the renderer
+  // swaps front with ready whenever ready is fresh
+  sim_snapshot snapshots[3];
+  int back;
+  int front;
+  std::atomic<u32> ready;
+  bool *unseen; // Moved since the last snapshot known to be taken
+
+#if SIM_THREADED
+  std::thread thread;
+#endif
+};
+
+// Starts the thread, which only touches game once it's sent something
+sim_thread *new_sim_thread(arena *, melon_state *game, iZ frame_reserve);
+// Stops the thread, the game is the caller's again once it returns
+void free_sim_thread(sim_thread *);
+
+void sim_thread_input(sim_thread *, input_event_type);
+// Asks for the fruit as of seconds after the last frame
+void sim_thread_frame(sim_thread *, float seconds);
+// The newest finished snapshot, which stays valid until the next call
+void sim_thread_latest(sim_thread *, renderer_input *);
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "types.h"
+
+/*     ======  SIMD lanes ======
+ * Thin wrappers over the widest float vectors the target has, so kernels are
+ * written once as templates over a lanes type and instantiated both with
+ * lanes_simd and lanes_scalar.
+ *
+ * Only plain IEEE add/sub/mul/div/sqrt and bitwise selects are exposed,
+ * which round identically on every path, so the SIMD kernels match the scalar
+ * ones bit for bit. That relies on the compiler not fusing multiply-adds
+ * either, build with -ffp-contract=off.
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_NAME "avx2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_NAME "sse2"
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define SIMD_NAME "simd128"
+#else
+#define SIMD_NAME "scalar"
+#endif
+
+// Alignment and padding for SoA arrays, enough for any of the paths
+#define SIMD_ALIGN     32
+#define SIMD_MAX_WIDTH 8
+
+struct lanes_scalar {
+  typedef float f32;
+  static const int width = 1;
+
+  static f32 load(const float *p) { return *p; }
+  static void store(float *p, f32 v) { *p = v; }
+  static f32 set1(float x) { return x; }
+  static f32 add(f32 a, f32 b) { return a + b; }
+  static f32 sub(f32 a, f32 b) { return a - b; }
+  static f32 mul(f32 a, f32 b) { return a * b; }
+  static f32 div(f32 a, f32 b) { return a / b; }
+  static f32 sqrt(f32 a) { return sqrtf(a); }
+  // b where a != 0, otherwise +0
+  static f32 and_nonzero(f32 a, f32 b) { return (a != 0.0f) ? b : 0.0f; }
+  // b where a != 0, otherwise c
+  static f32 select_nonzero(f32 a, f32 b, f32 c) {
+    return (a != 0.0f) ? b : c;
+  }
+};
+
+#if defined(__AVX2__)
+struct lanes_simd {
+  typedef __m256 f32;
+  static const int width = 8;
+
+  static f32 load(const float *p) { return _mm256_load_ps(p); }
+  static void store(float *p, f32 v) { _mm256_store_ps(p, v); }
+  static f32 set1(float x) { return _mm256_set1_ps(x); }
+  static f32 add(f32 a, f32 b) { return _mm256_add_ps(a, b); }
+  static f32 sub(f32 a, f32 b) { return _mm256_sub_ps(a, b); }
+  static f32 mul(f32 a, f32 b) { return _mm256_mul_ps(a, b); }
+  static f32 div(f32 a, f32 b) { return _mm256_div_ps(a, b); }
+  static f32 sqrt(f32 a) { return _mm256_sqrt_ps(a); }
+  static f32 and_nonzero(f32 a, f32 b) {
+    f32 mask = _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+    return _mm256_and_ps(mask, b);
+  }
+  static f32 select_nonzero(f32 a, f32 b, f32 c) {
+    f32 mask = _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+    return _mm256_blendv_ps(c, b, mask);
+  }
+};
+#elif defined(__SSE2__)
+struct lanes_simd {
+  typedef __m128 f32;
+  static const int width = 4;
+
+  static f32 load(const float *p) { return _mm_load_ps(p); }
+  static void store(float *p, f32 v) { _mm_store_ps(p, v); }
+  static f32 set1(float x) { return _mm_set1_ps(x); }
+  static f32 add(f32 a, f32 b) { return _mm_add_ps(a, b); }
+  static f32 sub(f32 a, f32 b) { return _mm_sub_ps(a, b); }
+  static f32 mul(f32 a, f32 b) { return _mm_mul_ps(a, b); }
+  static f32 div(f32 a, f32 b) { return _mm_div_ps(a, b); }
+  static f32 sqrt(f32 a) { return _mm_sqrt_ps(a); }
+  static f32 and_nonzero(f32 a, f32 b) {
+    return _mm_and_ps(_mm_cmpneq_ps(a, _mm_setzero_ps()), b);
+  }
+  static f32 select_nonzero(f32 a, f32 b, f32 c) {
+    f32 mask = _mm_cmpneq_ps(a, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, c));
+  }
+};
+#elif defined(__wasm_simd128__)
+struct lanes_simd {
+  typedef v128_t f32;
+  static const int width = 4;
+
+  static f32 load(const float *p) { return wasm_v128_load(p); }
+  static void store(float *p, f32 v) { wasm_v128_store(p, v); }
+  static f32 set1(float x) { return wasm_f32x4_splat(x); }
+  static f32 add(f32 a, f32 b) { return wasm_f32x4_add(a, b); }
+  static f32 sub(f32 a, f32 b) { return wasm_f32x4_sub(a, b); }
+  static f32 mul(f32 a, f32 b) { return wasm_f32x4_mul(a, b); }
+  static f32 div(f32 a, f32 b) { return wasm_f32x4_div(a, b); }
+  static f32 sqrt(f32 a) { return wasm_f32x4_sqrt(a); }
+  static f32 and_nonzero(f32 a, f32 b) {
+    return wasm_v128_and(wasm_f32x4_ne(a, wasm_f32x4_splat(0.0f)), b);
+  }
+  static f32 select_nonzero(f32 a, f32 b, f32 c) {
+    return wasm_v128_bitselect(b, c, wasm_f32x4_ne(a, wasm_f32x4_splat(0.0f)));
+  }
+};
+#else
+typedef lanes_scalar lanes_simd;
+#endif
@@ -0,0 +1,110 @@
+#include "trace.h"
+
+#if TRACE
+void trace_record(const char *name, u64 start_ns, u64 end_ns) {
+  thread_local u32 thread =
+      TRACE_ring.num_threads.fetch_add(1, std::memory_order_relaxed);
+  u64 k = TRACE_ring.next.fetch_add(1, std::memory_order_relaxed);
+  trace_event *e = &TRACE_ring.events[k % TRACE_MAX_EVENTS];
+  e->name = name;
+  e->start_ns = start_ns;
+  e->end_ns = end_ns;
+  e->thread = thread;
+}
+#endif
+
+bool trace_dump_chrome(const char *path) {
+#if TRACE
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    printf("Couldn't open %s for the trace\n", path);
+    return false;
+  }
+
+  u64 end = TRACE_ring.next.load(std::memory_order_relaxed);
+  u64 begin = end > TRACE_MAX_EVENTS ? end - TRACE_MAX_EVENTS : 0;
+  u64 origin_ns = ~(u64)0;
+  for (u64 k = begin; k < end; ++k) {
+    const trace_event &e = TRACE_ring.events[k % TRACE_MAX_EVENTS];
+    origin_ns = glm::min(origin_ns, e.start_ns);
+  }
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (u64 k = begin; k < end; ++k) {
+    const trace_event &e = TRACE_ring.events[k % TRACE_MAX_EVENTS];
+    // Timestamps in microseconds
+    fprintf(f,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            e.name, e.thread, (double)(e.start_ns - origin_ns) / 1e3,
+            (double)(e.end_ns - e.start_ns) / 1e3, k + 1 < end ? "," : "");
+  }
+  fprintf(f, "]}\n");
+
+  bool ok = !ferror(f);
+  ok &= fclose(f) == 0;
+  printf("Wrote %llu trace events to %s\n", (unsigned long long)(end - begin),
+         path);
+  return ok;
+#else
+  printf("Tracing is compiled out, build with -DTRACE=1 for %s\n", path);
+  return false;
+#endif
+}
+
+void frame_times_mark(frame_times *ft) {
+  u64 now = trace_now_ns();
+  if (ft->last_ns) {
+    ft->ns[ft->count % FRAME_TIMES_MAX] = now - ft->last_ns;
+    ft->count++;
+  }
+  ft->last_ns = now;
+}
+
+int frame_times_compare(const void *a, const void *b) {
+  u64 x = *(const u64 *)a;
+  u64 y = *(const u64 *)b;
+  return (x > y) - (x < y);
+}
+
+// Upper edges of the histogram buckets, the last catches everything else
+const double TABLE_frame_bucket_ms[] = {4.0, 8.0, 12.0, 16.7, 20.0,
+                                        25.0, 33.3, 50.0, 100.0};
+#define FRAME_BUCKETS (sizeof(TABLE_frame_bucket_ms) / sizeof(double) + 1)
+
+void frame_times_report(const frame_times *ft, arena *mem_temp) {
+  iZ n = (iZ)glm::min(ft->count, (u64)FRAME_TIMES_MAX);
+  if (n == 0) {
+    return;
+  }
+  arena scratch = *mem_temp;
+  u64 *sorted = arena_push<u64>(&scratch, n);
+  memcpy(sorted, ft->ns, (uZ)n * sizeof(u64));
+  qsort(sorted, (uZ)n, sizeof(u64), frame_times_compare);
+
+  auto ms = [&](iZ percent) {
+    return (double)sorted[n * percent / 100] / 1e6;
+  };
+  printf("frames n=%td p50_ms=%.2f p95_ms=%.2f p99_ms=%.2f max_ms=%.2f\n", n,
+         ms(50), ms(95), ms(99), (double)sorted[n - 1] / 1e6);
+
+  iZ counts[FRAME_BUCKETS] = {};
+  for (iZ i = 0; i < n; ++i) {
+    uZ b = 0;
+    while (b + 1 < FRAME_BUCKETS &&
+           (double)sorted[i] / 1e6 > TABLE_frame_bucket_ms[b]) {
+      ++b;
+    }
+    counts[b]++;
+  }
+  printf("frame_hist");
+  for (uZ b = 0; b < FRAME_BUCKETS; ++b) {
+    if (b + 1 < FRAME_BUCKETS) {
+      printf(" le_%.1f=%td", TABLE_frame_bucket_ms[b], counts[b]);
+    } else {
+      printf(" gt_%.1f=%td", TABLE_frame_bucket_ms[b - 1], counts[b]);
+    }
+  }
+  printf("\n");
+  fflush(stdout);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "types.h"
+
+#include <chrono>
+
+/*     ======  Tracing ======
+ * Scoped timing markers, written to one preallocated ring shared by every
+ * thread, and dumped as Chrome trace JSON (chrome://tracing, Perfetto).
+ * Old events are overwritten once it wraps.
+ *
+ * The markers compile out unless TRACE is set, which it is by default in
+ * builds without NDEBUG. Names have to be string literals, only the pointer
+ * is kept.
+ *
+ *   TRACE_SCOPE("upload");             // Until the end of the scope
+ *
+ *   TRACE_PHASES(phase, "integrate");  // Back to back phases of one scope,
+ *   TRACE_NEXT(phase, "broadphase");   // each ending where the next starts
+ *
+ * Frame times are kept whether or not TRACE is, they're one sample a frame.
+ */
+
+#ifndef TRACE
+#if defined(NDEBUG)
+#define TRACE 0
+#else
+#define TRACE 1
+#endif
+#endif
+
+u64 trace_now_ns() {
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+#if TRACE
+
+#define TRACE_MAX_EVENTS (1 << 16)
+
+struct trace_event {
+  const char *name;
+  u64 start_ns;
+  u64 end_ns;
+  u32 thread; // In the order threads first traced anything
+};
+
+struct trace_ring {
+  trace_event events[TRACE_MAX_EVENTS];
+  std::atomic<u64> next; // Events ever written
+  std::atomic<u32> num_threads;
+};
+
+trace_ring TRACE_ring;
+
+void trace_record(const char *name, u64 start_ns, u64 end_ns);
+
+struct trace_scope {
+  const char *name;
+  u64 start_ns;
+
+  trace_scope(const char *name) : name(name), start_ns(trace_now_ns()) {}
+  ~trace_scope() { trace_record(name, start_ns, trace_now_ns()); }
+};
+
+struct trace_phases {
+  const char *name;
+  u64 start_ns;
+
+  trace_phases(const char *name) : name(name), start_ns(trace_now_ns()) {}
+  ~trace_phases() { trace_record(name, start_ns, trace_now_ns()); }
+  void next(const char *next_name) {
+    u64 now = trace_now_ns();
+    trace_record(name, start_ns, now);
+    name = next_name;
+    start_ns = now;
+  }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) \
+  trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_PHASES(var, name) trace_phases var(name)
+#define TRACE_NEXT(var, name)   var.next(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_PHASES(var, name)
+#define TRACE_NEXT(var, name)
+
+#endif
+
+// Writes what's in the ring as Chrome trace JSON. Events still being
+// written by other threads can come out torn. False if it couldn't be
+// written, or tracing is compiled out.
+bool trace_dump_chrome(const char *path);
+
+/*     ======  Frame times ======
+ * The last FRAME_TIMES_MAX frames' durations, for percentiles and a
+ * histogram of where they fall.
+ */
+
+#define FRAME_TIMES_MAX 4096
+
+struct frame_times {
+  u64 ns[FRAME_TIMES_MAX];
+  u64 count;   // Frames ever marked
+  u64 last_ns; // When the last one was marked, 0 before the first
+};
+
+// Call once a frame, at the same point in it
+void frame_times_mark(frame_times *);
+void frame_times_report(const frame_times *, arena *mem_temp);
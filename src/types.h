@@ -5,16 +5,22 @@
 #include <cstddef>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+
+#include <atomic>
+#include <new>
 
 #include <glm/glm.hpp>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 typedef glm::vec3 vec3;
 typedef glm::vec4 vec4;
 typedef glm::mat3 mat3;
 typedef glm::mat4 mat4;
+typedef glm::quat quat;
 
 #define ASSERT(c) assert((c))
 
@@ -40,12 +46,63 @@ uLL operator""_KB(uLL s) { return s << 10; }
 uLL operator""_MB(uLL s) { return s << 20; }
 uLL operator""_GB(uLL s) { return s << 30; }
 
-// Bump down allocator
+/*     ======  Arenas ======
+ * Bump down allocators over a range of address space reserved up front,
+ * with pages committed as the tail reaches them, so a big reservation only
+ * costs what's actually used. WASM has no virtual memory, there the whole
+ * range is allocated at once and commits do nothing.
+ *
+ * Each range has an arena_block at its top, shared by every copy of the
+ * arena, saying how much is committed and the most that's been in use.
+ * Copies (`arena scratch = *mem;`) are the usual way to get scratch space
+ * that's dropped with the copy; arena_temp does the same for an arena
+ * that's passed around by pointer.
+ */
+
+#if defined(__EMSCRIPTEN__)
+#define ARENA_VIRTUAL 0
+#elif defined(_WIN32)
+#define ARENA_VIRTUAL 1
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#define ARENA_VIRTUAL 1
+#include <cerrno>
+#include <sys/mman.h>
+#endif
+
+// Native reservations are nearly free, WASM ones are allocated
+#if ARENA_VIRTUAL
+#define ARENA_RESERVE(native, wasm) (iZ)(native)
+#else
+#define ARENA_RESERVE(native, wasm) (iZ)(wasm)
+#endif
+
+#define ARENA_PAGE           (4 << 10)
+#define ARENA_COMMIT_GRANULE (64 << 10)
+#define ARENA_MAX_NAMED      32
+
+struct arena_block {
+  const char *name; // Arenas from arena_split have none and aren't reported
+  u8 *base;
+  u8 *top;
+  u8 *committed; // Usable from here to top
+
+  // In bytes, written only by the arena's thread
+  std::atomic<iZ> committed_bytes;
+  std::atomic<iZ> peak;       // Most ever in use
+  std::atomic<iZ> frame_peak; // Most in use since arena_new_frame
+  std::atomic<iZ> last_frame_peak;
+  std::atomic<iZ> frame_start; // In use at arena_new_frame
+};
+
 struct arena {
   u8 *head;
   u8 *tail;
+  arena_block *block;
 };
-arena new_arena(iZ size);
+arena new_arena(iZ reserve, const char *name);
 void  free_arena(arena *a);
 
 template <class T>
@@ -55,6 +112,26 @@ u8 *arena_push_bytes(arena *, iZ num_bytes, uZ align = 1);
 arena arena_split(arena *a, iZ num_bytes);
 void  arena_rejoin(arena *parent, arena *split);
 
+// Everything pushed between begin and end is popped by end
+struct arena_temp {
+  arena *a;
+  u8 *tail;
+};
+arena_temp arena_temp_begin(arena *);
+void arena_temp_end(arena_temp);
+
+// The calling thread's own scratch, made the first time it asks
+arena *thread_scratch();
+
+iZ arena_used(const arena *);
+// Starts a new frame for peak tracking
+void arena_new_frame(const arena *);
+// Gives back pages that haven't been needed, keeping enough below the tail
+// for keep more bytes. Nothing below the tail can be in use.
+void arena_trim(arena *, iZ keep);
+// Prints usage of every named arena
+void arena_report();
+
 // Contiguous fixed size array, with swap&pop erase
 template <class T>
 struct array {
@@ -80,27 +157,166 @@ void free_array(array<T> *);
 
 //
 
-arena new_arena(iZ size) {
-  ASSERT(size > 0);
-  u8 *head = (u8 *)calloc((uZ)size, 1);
-  ASSERT(head);
-  return {.head = head, .tail = head + size};
+/*     ======  Pages ====== */
+
+u8 *pages_reserve(iZ size) {
+#if !ARENA_VIRTUAL
+  u8 *result = (u8 *)calloc((uZ)size, 1);
+#elif defined(_WIN32)
+  u8 *result =
+      (u8 *)VirtualAlloc(nullptr, (SIZE_T)size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+  u8 *result = (u8 *)mmap(nullptr, (uZ)size, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (result == (u8 *)MAP_FAILED) {
+    result = nullptr;
+  }
+#endif
+  if (!result) {
+    printf("Couldn't reserve %td bytes\n", size);
+    exit(1);
+  }
+  return result;
+}
+
+void pages_release(u8 *p, iZ size) {
+#if !ARENA_VIRTUAL
+  (void)size;
+  free(p);
+#elif defined(_WIN32)
+  (void)size;
+  VirtualFree(p, 0, MEM_RELEASE);
+#else
+  munmap(p, (uZ)size);
+#endif
+}
+
+// Out of memory here has nowhere to go, the arena's next push would fault
+void pages_commit(u8 *p, iZ size) {
+#if !ARENA_VIRTUAL
+  (void)p, (void)size;
+#elif defined(_WIN32)
+  if (!VirtualAlloc(p, (SIZE_T)size, MEM_COMMIT, PAGE_READWRITE)) {
+    printf("Couldn't commit %td bytes, error %lu\n", size, GetLastError());
+    exit(1);
+  }
+#else
+  if (mprotect(p, (uZ)size, PROT_READ | PROT_WRITE)) {
+    printf("Couldn't commit %td bytes: %s\n", size, strerror(errno));
+    exit(1);
+  }
+#endif
+}
+
+void pages_decommit(u8 *p, iZ size) {
+#if !ARENA_VIRTUAL
+  (void)p, (void)size;
+#elif defined(_WIN32)
+  VirtualFree(p, (SIZE_T)size, MEM_DECOMMIT);
+#else
+  madvise(p, (uZ)size, MADV_DONTNEED);
+  mprotect(p, (uZ)size, PROT_NONE);
+#endif
+}
+
+u8 *align_down(u8 *p, uZ align) {
+  return (u8 *)((uintptr_t)p & ~(uintptr_t)(align - 1));
+}
+u8 *align_up(u8 *p, uZ align) { return align_down(p + align - 1, align); }
+
+/*     ======  Arenas ====== */
+
+std::atomic<arena_block *> ARENA_named[ARENA_MAX_NAMED];
+std::atomic<int> ARENA_num_named;
+
+// Commits down to at least new_tail
+void arena_commit(arena_block *b, u8 *new_tail) {
+  u8 *lo = align_down(new_tail, ARENA_COMMIT_GRANULE);
+  u8 *lowest = align_down(b->base, ARENA_PAGE);
+  lo = lo > lowest ? lo : lowest;
+  pages_commit(lo, b->committed - lo);
+  b->committed = lo;
+  b->committed_bytes.store(b->top - lo, std::memory_order_relaxed);
+}
+
+// An arena over [base, top), with its block at the top
+arena arena_place(u8 *base, u8 *top, const char *name) {
+  u8 *block_at = align_down(top - sizeof(arena_block), alignof(arena_block));
+  ASSERT(block_at > base);
+  u8 *committed = align_up(top, ARENA_PAGE);
+  u8 *lo = align_down(block_at, ARENA_PAGE);
+  u8 *lowest = align_down(base, ARENA_PAGE);
+  lo = lo > lowest ? lo : lowest;
+  pages_commit(lo, committed - lo);
+
+  arena_block *b = new (block_at) arena_block;
+  b->name = name;
+  b->base = base;
+  b->top = block_at;
+  b->committed = lo;
+  b->committed_bytes = block_at - lo;
+  b->peak = b->frame_peak = b->last_frame_peak = b->frame_start = 0;
+  return {.head = base, .tail = block_at, .block = b};
+}
+
+void arena_track(arena_block *b, iZ used) {
+  if (used > b->frame_peak.load(std::memory_order_relaxed)) {
+    b->frame_peak.store(used, std::memory_order_relaxed);
+    if (used > b->peak.load(std::memory_order_relaxed)) {
+      b->peak.store(used, std::memory_order_relaxed);
+    }
+  }
+}
+
+arena new_arena(iZ reserve, const char *name) {
+  ASSERT(reserve > 0);
+  reserve = (reserve + ARENA_COMMIT_GRANULE - 1) &
+            ~(iZ)(ARENA_COMMIT_GRANULE - 1);
+  u8 *base = pages_reserve(reserve);
+  arena result = arena_place(base, base + reserve, name);
+  int k = ARENA_num_named.fetch_add(1, std::memory_order_relaxed);
+  if (k < ARENA_MAX_NAMED) {
+    ARENA_named[k].store(result.block, std::memory_order_relaxed);
+  }
+  return result;
 }
 
 void free_arena(arena *a) {
   ASSERT(a->head);
-  free(a->head);
+  arena_block *b = a->block;
+  for (std::atomic<arena_block *> &named : ARENA_named) {
+    if (named.load(std::memory_order_relaxed) == b) {
+      named.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  u8 *base = b->base;
+  iZ reserve = align_up(b->top, ARENA_COMMIT_GRANULE) - base;
+  b->~arena_block();
+  pages_release(base, reserve);
   a->head = a->tail = 0;
+  a->block = nullptr;
+}
+
+iZ arena_used(const arena *a) {
+  return (a->head - a->block->base) + (a->block->top - a->tail);
 }
 
 u8 *arena_push_bytes(arena *a, iZ num_bytes, uZ align) {
   u8 *aligned_tail = (u8 *)((uintptr_t)a->tail & ~(align - 1));
 
+  // The reserves are fixed, and on the web there's no guard page below
+  // them, so running out has to stop here in every build
   iZ free = aligned_tail - a->head;
   if (free < num_bytes) {
-    ASSERT(0); // OOM
+    printf("Arena %s out of memory, %td bytes wanted with %td free\n",
+           a->block->name ? a->block->name : "(split)", num_bytes, free);
+    exit(1);
   }
   a->tail = aligned_tail - num_bytes;
+  if (a->tail < a->block->committed) {
+    arena_commit(a->block, a->tail);
+  }
+  arena_track(a->block, arena_used(a));
   return a->tail;
 }
 
@@ -111,11 +327,15 @@ T *arena_push(arena *a, iZ num_T) {
 }
 
 arena arena_split(arena *a, iZ num_bytes) {
-  arena result;
-  result.head = a->head;
-  result.tail = a->head + num_bytes;
-  ASSERT(result.tail <= a->tail);
-  a->head = result.tail;
+  if (a->tail - a->head < num_bytes) {
+    printf("Arena %s can't split off %td bytes with %td free\n",
+           a->block->name ? a->block->name : "(split)", num_bytes,
+           a->tail - a->head);
+    exit(1);
+  }
+  arena result = arena_place(a->head, a->head + num_bytes, nullptr);
+  a->head += num_bytes;
+  arena_track(a->block, arena_used(a));
   return result;
 }
 void arena_rejoin(arena *parent, arena *split) {
@@ -124,6 +344,62 @@ void arena_rejoin(arena *parent, arena *split) {
   split->tail  = split->head;
 }
 
+arena_temp arena_temp_begin(arena *a) { return {.a = a, .tail = a->tail}; }
+void arena_temp_end(arena_temp temp) { temp.a->tail = temp.tail; }
+
+#define ARENA_SCRATCH_RESERVE ARENA_RESERVE(1_GB, 8_MB)
+
+struct thread_scratch_arena {
+  arena a = new_arena(ARENA_SCRATCH_RESERVE, "scratch");
+  ~thread_scratch_arena() { free_arena(&a); }
+};
+
+arena *thread_scratch() {
+  thread_local thread_scratch_arena scratch;
+  return &scratch.a;
+}
+
+void arena_new_frame(const arena *a) {
+  arena_block *b = a->block;
+  iZ used = arena_used(a);
+  b->last_frame_peak.store(b->frame_peak.load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+  b->frame_peak.store(used, std::memory_order_relaxed);
+  b->frame_start.store(used, std::memory_order_relaxed);
+}
+
+void arena_trim(arena *a, iZ keep) {
+  arena_block *b = a->block;
+  // Only ever pushed to above head, what's below belongs to splits
+  u8 *lo = align_up(a->head, ARENA_PAGE);
+  lo = lo > b->committed ? lo : b->committed;
+  u8 *hi = align_down(a->tail - keep, ARENA_COMMIT_GRANULE);
+  if (hi > lo) {
+    pages_decommit(lo, hi - lo);
+    b->committed = hi;
+    b->committed_bytes.store(b->top - hi, std::memory_order_relaxed);
+  }
+}
+
+void arena_report() {
+  int num = glm::min(ARENA_num_named.load(std::memory_order_relaxed),
+                     ARENA_MAX_NAMED);
+  for (int k = 0; k < num; ++k) {
+    arena_block *b = ARENA_named[k].load(std::memory_order_relaxed);
+    if (!b) {
+      continue;
+    }
+    auto kb = [](const std::atomic<iZ> &bytes) {
+      return (double)bytes.load(std::memory_order_relaxed) / 1024.0;
+    };
+    printf("arena name=%s reserved_mb=%.0f committed_kb=%.0f peak_kb=%.0f "
+           "frame_start_kb=%.0f frame_peak_kb=%.0f\n",
+           b->name, (double)(b->top - b->base) / (1 << 20),
+           kb(b->committed_bytes), kb(b->peak), kb(b->frame_start),
+           kb(b->last_frame_peak));
+  }
+}
+
 template <class T>
 array<T> new_array(arena *a, iZ cap) {
   T *store = arena_push<T>(a, cap);